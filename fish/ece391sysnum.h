@@ -11,5 +11,17 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_SBRK    11
+#define SYS_MMAP    12
+#define SYS_MUNMAP  13
+#define SYS_SHMGET  14
+#define SYS_SHMAT   15
+#define SYS_SHMDT   16
+#define SYS_NICE    17
+#define SYS_GETPROCS 18
+#define SYS_GETTRACE 19
+#define SYS_IOCTL 20
+#define SYS_FBMAP 21
+#define SYS_FBFLIP 22
 
 #endif /* ECE391SYSNUM_H */
@@ -0,0 +1,465 @@
+/* fb.c - VBE linear framebuffer console and page flipping
+ * vim:ts=4 noexpandtab */
+
+#include "fb.h"
+#include "lib.h"
+#include "paging.h"
+#include "terminal.h"
+#include "lock.h"
+
+#define TEXT_COLS           (FB_WIDTH / GLYPH_WIDTH)
+#define TEXT_ROWS           (FB_HEIGHT / GLYPH_HEIGHT)
+#define TEXT_CELLS          (TEXT_COLS * TEXT_ROWS)
+#define GLYPH_HASH          37      // spreads attributes over the glyph cache
+
+int32_t fb_enabled = 0;
+// linear framebuffer, identity mapped and uncached
+static uint32_t* lfb;
+// the text screen in pixels, blitted to lfb one dirty rectangle at a time
+static uint32_t back[FB_WIDTH * FB_HEIGHT];
+// 8x16 font copied from VGA plane 2, one byte per glyph row
+static uint8_t font[256][GLYPH_HEIGHT];
+// cell drawn at each position of back, FB_NO_CELL to force a redraw
+static uint32_t shadow[TEXT_CELLS];
+// position of the drawn cursor, -1 if none
+static int32_t drawn_cursor = -1;
+
+/* a cell expanded to pixels */
+typedef struct {
+    uint32_t cell;                      // character and attribute, FB_NO_CELL if empty
+    uint32_t px[GLYPH_WIDTH * GLYPH_HEIGHT];
+} glyph_t;
+static glyph_t glyph_cache[GLYPH_CACHE_SIZE];
+
+// frames of each terminal's graphics buffer, [0] is 0 while it shows text
+static uint32_t gfx_frames[TERMINAL_COUNT][FB_PAGES];
+// pid of the process drawing into each graphics buffer
+static uint32_t gfx_pid[TERMINAL_COUNT];
+// terminal whose graphics buffer is on the screen, -1 while text is shown
+static int32_t gfx_shown = -1;
+
+// the 16 VGA text colors as 0xRRGGBB
+static const uint32_t vga_palette[16] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF
+};
+
+/* dispi_read(uint16_t reg)
+ *
+ * Description: read a register of the Bochs display interface
+ * Inputs: reg -- register index
+ * Outputs: None
+ * Return Value: register value
+ */
+static uint16_t dispi_read(uint16_t reg) {
+    outw(reg, DISPI_INDEX);
+    return inw(DISPI_DATA);
+}
+
+/* dispi_write(uint16_t reg, uint16_t value)
+ *
+ * Description: write a register of the Bochs display interface
+ * Inputs: reg -- register index
+ *         value -- new value
+ * Outputs: None
+ * Return Value: None
+ */
+static void dispi_write(uint16_t reg, uint16_t value) {
+    outw(reg, DISPI_INDEX);
+    outw(value, DISPI_DATA);
+}
+
+/* pci_find_lfb()
+ *
+ * Description: look for the Bochs/QEMU VGA device on PCI bus 0, its first
+ *              BAR is the linear framebuffer
+ * Inputs: None
+ * Outputs: None
+ * Return Value: physical address of the framebuffer
+ */
+static uint32_t pci_find_lfb() {
+    uint32_t dev, addr;
+    for (dev = 0; dev < PCI_SLOTS; dev++) {
+        addr = PCI_ENABLE | (dev << PCI_DEVICE_SHIFT);
+        outl(addr, PCI_CONFIG_ADDR);
+        if (inl(PCI_CONFIG_DATA) != PCI_VGA_ID)
+            continue;
+        outl(addr | PCI_BAR0, PCI_CONFIG_ADDR);
+        return inl(PCI_CONFIG_DATA) & PCI_BAR_MASK;
+    }
+    return FB_DEFAULT_LFB;
+}
+
+/* read_font()
+ *
+ * Description: copy the font the VGA uses in text mode out of plane 2,
+ *              which must happen before the mode switch
+ * Inputs: None
+ * Outputs: None
+ * Return Value: None
+ */
+static void read_font() {
+    uint8_t* plane = (uint8_t*)VGA_FONT_ADDR;
+    int32_t c, row;
+
+    map_low_range(VGA_FONT_ADDR, VGA_FONT_ADDR + VGA_FONT_SIZE);
+    // write plane 2 only, sequential addressing, read plane 2 at 0xA0000
+    outb(0x02, VGA_SEQ_INDEX); outb(0x04, VGA_SEQ_DATA);
+    outb(0x04, VGA_SEQ_INDEX); outb(0x07, VGA_SEQ_DATA);
+    outb(0x04, VGA_GC_INDEX);  outb(0x02, VGA_GC_DATA);
+    outb(0x05, VGA_GC_INDEX);  outb(0x00, VGA_GC_DATA);
+    outb(0x06, VGA_GC_INDEX);  outb(0x04, VGA_GC_DATA);
+    for (c = 0; c < 256; c++) {
+        for (row = 0; row < GLYPH_HEIGHT; row++)
+            font[c][row] = plane[c * VGA_FONT_STRIDE + row];
+    }
+    // back to odd/even text mode at 0xB8000
+    outb(0x02, VGA_SEQ_INDEX); outb(0x03, VGA_SEQ_DATA);
+    outb(0x04, VGA_SEQ_INDEX); outb(0x03, VGA_SEQ_DATA);
+    outb(0x04, VGA_GC_INDEX);  outb(0x00, VGA_GC_DATA);
+    outb(0x05, VGA_GC_INDEX);  outb(0x10, VGA_GC_DATA);
+    outb(0x06, VGA_GC_INDEX);  outb(0x0E, VGA_GC_DATA);
+    unmap_low_range(VGA_FONT_ADDR, VGA_FONT_ADDR + VGA_FONT_SIZE);
+}
+
+/* blit_row(uint32_t* dst, const uint32_t* src, uint32_t n)
+ *
+ * Description: copy n pixels with one rep movsl
+ * Inputs: dst, src -- first pixels
+ *         n -- number of pixels
+ * Outputs: None
+ * Return Value: None
+ */
+static inline void blit_row(uint32_t* dst, const uint32_t* src, uint32_t n) {
+    asm volatile ("cld; rep movsl"
+        : "+D"(dst), "+S"(src), "+c"(n)
+        :
+        : "memory", "cc"
+    );
+}
+
+/* glyph(uint16_t cell)
+ *
+ * Description: pixels of a text cell, rendered on a glyph cache miss
+ * Inputs: cell -- character in the low byte, VGA attribute in the high byte
+ * Outputs: None
+ * Return Value: GLYPH_WIDTH * GLYPH_HEIGHT pixels, row by row
+ */
+static const uint32_t* glyph(uint16_t cell) {
+    uint8_t ch = cell & 0xFF;
+    uint8_t attrib = cell >> 8;
+    glyph_t* g = &glyph_cache[(ch + attrib * GLYPH_HASH) & (GLYPH_CACHE_SIZE - 1)];
+    uint32_t fg, bg, row, col, bits;
+
+    if (g->cell == cell)
+        return g->px;
+    fg = vga_palette[attrib & 0x0F];
+    // bit 7 selects blinking in text mode, which is not emulated
+    bg = vga_palette[(attrib >> 4) & 0x07];
+    for (row = 0; row < GLYPH_HEIGHT; row++) {
+        bits = font[ch][row];
+        for (col = 0; col < GLYPH_WIDTH; col++)
+            g->px[row * GLYPH_WIDTH + col] = (bits & (0x80 >> col)) ? fg : bg;
+    }
+    g->cell = cell;
+    return g->px;
+}
+
+/* draw_cell(uint32_t pos, uint16_t cell, int32_t cursor)
+ *
+ * Description: render one text cell into the back buffer
+ * Inputs: pos -- cell index on the screen
+ *         cell -- character and attribute
+ *         cursor -- nonzero to underline the cell with the cursor
+ * Outputs: None
+ * Return Value: None
+ */
+static void draw_cell(uint32_t pos, uint16_t cell, int32_t cursor) {
+    const uint32_t* px = glyph(cell);
+    uint32_t* dst = back + (pos / TEXT_COLS) * GLYPH_HEIGHT * FB_WIDTH + (pos % TEXT_COLS) * GLYPH_WIDTH;
+    uint32_t row, col;
+
+    for (row = 0; row < GLYPH_HEIGHT; row++) {
+        blit_row(dst, px, GLYPH_WIDTH);
+        if (cursor && row >= CURSOR_FIRST_ROW) {
+            for (col = 0; col < GLYPH_WIDTH; col++)
+                dst[col] = vga_palette[(cell >> 8) & 0x0F];
+        }
+        dst += FB_WIDTH;
+        px += GLYPH_WIDTH;
+    }
+}
+
+/* invalidate_text()
+ *
+ * Description: make the next fb_draw_text redraw every cell, after the
+ *              screen showed something else
+ * Inputs: None
+ * Outputs: None
+ * Return Value: None
+ */
+static void invalidate_text() {
+    memset_dword(shadow, FB_NO_CELL, TEXT_CELLS);
+}
+
+/* gfx_blit(uint8_t term_num, const fb_rect_t* r)
+ *
+ * Description: copy a clipped rectangle of a terminal's graphics buffer to
+ *              the screen. The buffer is made of separate frames, so rows
+ *              are split where they cross a frame.
+ * Inputs: term_num -- terminal owning the buffer
+ *         r -- rectangle inside the screen
+ * Outputs: None
+ * Return Value: None
+ */
+static void gfx_blit(uint8_t term_num, const fb_rect_t* r) {
+    uint32_t off, n, in, chunk;
+    int32_t y;
+
+    for (y = r->y; y < r->y + r->h; y++) {
+        off = y * FB_WIDTH + r->x;
+        n = r->w;
+        while (n > 0) {
+            in = off % FB_PIXELS_PER_PAGE;
+            chunk = FB_PIXELS_PER_PAGE - in < n ? FB_PIXELS_PER_PAGE - in : n;
+            blit_row(lfb + off, (uint32_t*)gfx_frames[term_num][off / FB_PIXELS_PER_PAGE] + in, chunk);
+            off += chunk;
+            n -= chunk;
+        }
+    }
+}
+
+/*
+ * int32_t fb_init();
+ * Inputs: None
+ * Return Value: 0 on success, -1 if there is no Bochs/QEMU display
+ * Function: read the text font, switch the display to a 640x400x32 linear
+ *           framebuffer and move the text terminals to RAM, since VGA text
+ *           memory is not reachable in graphics mode. Called before
+ *           interrupts are enabled.
+ */
+int32_t fb_init() {
+    uint32_t addr, i;
+
+    if ((dispi_read(DISPI_REG_ID) & DISPI_ID_MASK) != DISPI_ID_BASE)
+        return -1;
+    read_font();
+    addr = pci_find_lfb();
+    map_mmio_4MB(addr);
+    map_mmio_4MB(addr + FB_SIZE - 1);
+    lfb = (uint32_t*)addr;
+
+    dispi_write(DISPI_REG_ENABLE, 0);
+    dispi_write(DISPI_REG_XRES, FB_WIDTH);
+    dispi_write(DISPI_REG_YRES, FB_HEIGHT);
+    dispi_write(DISPI_REG_BPP, FB_BPP);
+    dispi_write(DISPI_REG_ENABLE, DISPI_ENABLED | DISPI_LFB_ENABLED);
+
+    for (i = 0; i < GLYPH_CACHE_SIZE; i++)
+        glyph_cache[i].cell = FB_NO_CELL;
+    invalidate_text();
+    fb_enabled = 1;
+    console_use_ram();
+    return 0;
+}
+
+/*
+ * void fb_draw_text(uint8_t term_num, const uint16_t* cells, int32_t cursor);
+ * Inputs: term_num -- terminal on the screen
+ *         cells -- its visible window of text cells
+ *         cursor -- cell index of the cursor, -1 to hide it
+ * Return Value: None
+ * Function: render the cells that differ from what back holds and blit the
+ *           rectangle around them. A terminal with a graphics buffer is
+ *           shown from that buffer instead. The caller holds console_lock.
+ */
+void fb_draw_text(uint8_t term_num, const uint16_t* cells, int32_t cursor) {
+    fb_rect_t r;
+    uint32_t pos, first = TEXT_CELLS, last = 0;
+
+    if (!fb_enabled)
+        return;
+    if (gfx_frames[term_num][0] != 0) {
+        if (gfx_shown != term_num) {
+            r.x = r.y = 0;
+            r.w = FB_WIDTH;
+            r.h = FB_HEIGHT;
+            gfx_blit(term_num, &r);
+            gfx_shown = term_num;
+            invalidate_text();
+        }
+        return;
+    }
+    gfx_shown = -1;
+
+    // the cells under the old and new cursor are redrawn
+    if (cursor != drawn_cursor) {
+        if (drawn_cursor >= 0)
+            shadow[drawn_cursor] = FB_NO_CELL;
+        if (cursor >= 0)
+            shadow[cursor] = FB_NO_CELL;
+        drawn_cursor = cursor;
+    }
+    for (pos = 0; pos < TEXT_CELLS; pos++) {
+        if (shadow[pos] == cells[pos])
+            continue;
+        draw_cell(pos, cells[pos], (int32_t)pos == cursor);
+        shadow[pos] = cells[pos];
+        if (pos < first)
+            first = pos;
+        last = pos;
+    }
+    if (first > last)
+        return;
+
+    // one changed row blits only its changed columns, several rows blit whole
+    if (first / TEXT_COLS == last / TEXT_COLS) {
+        r.x = (first % TEXT_COLS) * GLYPH_WIDTH;
+        r.w = (last - first + 1) * GLYPH_WIDTH;
+    }
+    else {
+        r.x = 0;
+        r.w = FB_WIDTH;
+    }
+    r.y = (first / TEXT_COLS) * GLYPH_HEIGHT;
+    r.h = (last / TEXT_COLS - first / TEXT_COLS + 1) * GLYPH_HEIGHT;
+    for (pos = r.y; pos < (uint32_t)(r.y + r.h); pos++)
+        blit_row(lfb + pos * FB_WIDTH + r.x, back + pos * FB_WIDTH + r.x, r.w);
+}
+
+/*
+ * void fb_release(pcb_t* pcb);
+ * Inputs: pcb_t* pcb -- halting process
+ * Return Value: None
+ * Function: unmap and free the graphics buffer the process drew into and
+ *           put its terminal's text back on the screen
+ */
+void fb_release(pcb_t* pcb) {
+    uint8_t term = pcb->terminal_id;
+    uint32_t flags, i;
+
+    if (gfx_frames[term][0] == 0 || gfx_pid[term] != pcb->pid)
+        return;
+    detach_user_range(pcb, FB_USER_ADDR, FB_USER_ADDR + FB_PAGES * _4KB);
+    spin_lock_irqsave(&console_lock, flags);
+    for (i = 0; i < FB_PAGES; i++) {
+        free_frame(gfx_frames[term][i]);
+        gfx_frames[term][i] = 0;
+    }
+    if (gfx_shown == term) {
+        invalidate_text();
+        update_cursor();
+    }
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+/*
+ * int32_t fbmap(uint8_t** buf);
+ * Inputs: uint8_t** buf -- where to store the address of the buffer
+ * Return Value: the user address of the buffer, -1 on failure
+ * Function: give the calling process a FB_WIDTH x FB_HEIGHT buffer of
+ *           0x00RRGGBB pixels for its terminal. The terminal shows the
+ *           buffer from now on, updated by fbflip, until the process halts.
+ */
+int32_t fbmap(uint8_t** buf) {
+    pcb_t* pcb = get_pcb();
+    uint8_t term = pcb->terminal_id;
+    uint32_t frames[FB_PAGES];
+    uint32_t flags, i;
+
+    if (!fb_enabled || buf == NULL)
+        return -1;
+    if ((uint32_t)buf < VM_START_ADDR || (uint32_t)buf >= VM_END_ADDR)
+        return -1;
+    // one program per terminal draws at a time
+    if (gfx_frames[term][0] != 0)
+        return gfx_pid[term] == pcb->pid ? FB_USER_ADDR : -1;
+
+    // fill a local array, the screen may be redrawn from gfx_frames by an
+    // interrupt at any time and must never see it half filled
+    for (i = 0; i < FB_PAGES; i++) {
+        frames[i] = alloc_zeroed_frame();
+        if (frames[i] == 0)
+            break;
+        if (map_user_page(pcb, FB_USER_ADDR + i * _4KB, frames[i]) == -1) {
+            i++;
+            break;
+        }
+    }
+    if (i == FB_PAGES) {
+        spin_lock_irqsave(&console_lock, flags);
+        if (gfx_frames[term][0] == 0) {
+            memcpy(gfx_frames[term], frames, sizeof(frames));
+            gfx_pid[term] = pcb->pid;
+            // show the blank buffer right away if the terminal is on screen
+            if (term == screen_terminal)
+                update_cursor();
+            spin_unlock_irqrestore(&console_lock, flags);
+            *buf = (uint8_t*)FB_USER_ADDR;
+            return FB_USER_ADDR;
+        }
+        spin_unlock_irqrestore(&console_lock, flags);
+    }
+
+    // nothing was published, so the frames were never on screen
+    detach_user_range(pcb, FB_USER_ADDR, FB_USER_ADDR + FB_PAGES * _4KB);
+    while (i > 0) {
+        i--;
+        if (frames[i] != 0)
+            free_frame(frames[i]);
+    }
+    return -1;
+}
+
+/*
+ * int32_t fbflip(const fb_rect_t* rect);
+ * Inputs: const fb_rect_t* rect -- part of the buffer to show, NULL for all
+ * Return Value: 0 on success, -1 if the caller has no buffer or rect is bad
+ * Function: copy a finished frame, or the rectangle of it that changed,
+ *           from the caller's buffer to the screen. Nothing is copied while
+ *           another terminal is shown; switching back shows the last frame.
+ */
+int32_t fbflip(const fb_rect_t* rect) {
+    pcb_t* pcb = get_pcb();
+    uint8_t term = pcb->terminal_id;
+    uint32_t flags;
+    fb_rect_t r;
+
+    if (gfx_frames[term][0] == 0 || gfx_pid[term] != pcb->pid)
+        return -1;
+    r.x = r.y = 0;
+    r.w = FB_WIDTH;
+    r.h = FB_HEIGHT;
+    if (rect != NULL) {
+        if ((uint32_t)rect < VM_START_ADDR || (uint32_t)rect + sizeof(fb_rect_t) > FB_USER_END)
+            return -1;
+        r = *rect;
+        // clip to the screen without overflowing on user values: the sums
+        // below add a negative offset to a positive size, and the sizes
+        // are only compared with what is left of the screen
+        if (r.w <= 0 || r.h <= 0 || r.x >= FB_WIDTH || r.y >= FB_HEIGHT)
+            return 0;
+        if (r.x < 0) { r.w += r.x; r.x = 0; }
+        if (r.y < 0) { r.h += r.y; r.y = 0; }
+        if (r.w <= 0 || r.h <= 0)
+            return 0;
+        if (r.w > FB_WIDTH - r.x) r.w = FB_WIDTH - r.x;
+        if (r.h > FB_HEIGHT - r.y) r.h = FB_HEIGHT - r.y;
+    }
+
+    spin_lock_irqsave(&console_lock, flags);
+    if (term == screen_terminal) {
+        gfx_blit(term, &r);
+        if (gfx_shown != term) {
+            // the rest of the screen still holds text, show the whole frame
+            r.x = r.y = 0;
+            r.w = FB_WIDTH;
+            r.h = FB_HEIGHT;
+            gfx_blit(term, &r);
+            gfx_shown = term;
+            invalidate_text();
+        }
+    }
+    spin_unlock_irqrestore(&console_lock, flags);
+    return 0;
+}
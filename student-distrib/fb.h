@@ -0,0 +1,73 @@
+#ifndef _FB_H
+#define _FB_H
+
+#include "types.h"
+#include "system_calls.h"
+
+#define FB_WIDTH            640     // 80 columns of 8 pixel glyphs
+#define FB_HEIGHT           400     // 25 rows of 16 pixel glyphs
+#define FB_BPP              32
+#define FB_SIZE             (FB_WIDTH * FB_HEIGHT * 4)
+#define FB_PAGES            ((FB_SIZE + _4KB - 1) / _4KB)
+#define FB_PIXELS_PER_PAGE  (_4KB / 4)
+#define GLYPH_WIDTH         8
+#define GLYPH_HEIGHT        16
+#define GLYPH_CACHE_SIZE    128     // rendered cells kept, a power of two
+#define CURSOR_FIRST_ROW    14      // glyph rows covered by the cursor
+#define FB_NO_CELL          0xFFFFFFFF
+
+// Bochs/QEMU display interface (-vga std)
+#define DISPI_INDEX         0x1CE
+#define DISPI_DATA          0x1CF
+#define DISPI_REG_ID        0
+#define DISPI_REG_XRES      1
+#define DISPI_REG_YRES      2
+#define DISPI_REG_BPP       3
+#define DISPI_REG_ENABLE    4
+#define DISPI_ID_MASK       0xFFF0
+#define DISPI_ID_BASE       0xB0C0
+#define DISPI_ENABLED       0x01
+#define DISPI_LFB_ENABLED   0x40
+#define FB_DEFAULT_LFB      0xFD000000  // QEMU's default if the PCI BAR is not found
+
+#define PCI_CONFIG_ADDR     0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+#define PCI_ENABLE          0x80000000
+#define PCI_SLOTS           32          // devices scanned on bus 0
+#define PCI_DEVICE_SHIFT    11
+#define PCI_BAR0            0x10
+#define PCI_BAR_MASK        0xFFFFFFF0
+#define PCI_VGA_ID          0x11111234  // device 1111, vendor 1234
+
+// VGA registers used to read the font out of plane 2
+#define VGA_SEQ_INDEX       0x3C4
+#define VGA_SEQ_DATA        0x3C5
+#define VGA_GC_INDEX        0x3CE
+#define VGA_GC_DATA         0x3CF
+#define VGA_FONT_ADDR       0xA0000
+#define VGA_FONT_STRIDE     32          // bytes per glyph in plane 2
+#define VGA_FONT_SIZE       (256 * VGA_FONT_STRIDE)
+
+/* part of the screen a flip copies, in pixels */
+typedef struct {
+    int32_t x;
+    int32_t y;
+    int32_t w;
+    int32_t h;
+} fb_rect_t;
+
+// set once the framebuffer console replaced VGA text mode
+extern int32_t fb_enabled;
+
+/* Switch to a VBE linear framebuffer and draw the text console into it */
+int32_t fb_init();
+/* Draw the cells of a text terminal that changed since the last call */
+void fb_draw_text(uint8_t term_num, const uint16_t* cells, int32_t cursor);
+/* Drop the graphics buffer of a halting process */
+void fb_release(pcb_t* pcb);
+/* Map the graphics buffer of the caller's terminal into user space */
+int32_t fbmap(uint8_t** buf);
+/* Copy a rectangle of the graphics buffer to the screen */
+int32_t fbflip(const fb_rect_t* rect);
+
+#endif
@@ -142,6 +142,20 @@ int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t lengt
   return read_count;
 }
 
+/* get_file_size
+ *
+ * Description: get the size of a file in bytes
+ * Inputs: inode -- the index node of the file
+ * Outputs: None
+ * Return Value: file length, 0 if inode is invalid
+ * Side Effects: None
+ */
+uint32_t get_file_size(uint32_t inode){
+  if (inode >= boot_block->inode_count)
+    return 0;
+  return ((inode_t*)((uint32_t)index_node + inode*BLK_SIZE))->blk_length;
+}
+
 /* open_file
  *
  * Description: open the file
@@ -46,6 +46,9 @@ int32_t read_dentry_by_index (int32_t index, dentry_t* dentry);
 /* store data into buf starting from offset and read length bytes */
 int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
 
+/* get the size of a file in bytes */
+uint32_t get_file_size(uint32_t inode);
+
 /* open the file */
 int32_t open_file(const uint8_t* filename);
 
@@ -0,0 +1,162 @@
+#include "fpu.h"
+#include "lib.h"
+
+// process whose state is live in the fpu registers, NULL if nobody's is
+static pcb_t* fpu_owner;
+// set if the CPU supports fxsave/fxrstor, otherwise fall back to fnsave
+static int32_t fxsr_present;
+// state after fninit, loaded on the first fpu use of every process
+static uint8_t fpu_clean[FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+/* fpu_state(pcb_t* pcb)
+ *
+ * Description: the fxsave image of a process. pcb_t is packed, so the
+ *              area is padded and aligned here instead of in the struct.
+ * Inputs: pcb -- process owning the image
+ * Outputs: None
+ * Return Value: 16-byte aligned pointer into pcb->fpu_area
+ */
+static uint8_t* fpu_state(pcb_t* pcb) {
+    return (uint8_t*)(((uint32_t)pcb->fpu_area + 15) & ~15);
+}
+
+/* fpu_save(uint8_t* state)
+ *
+ * Description: store the fpu/SSE registers into a 16-byte aligned image
+ * Inputs: state -- destination image
+ * Outputs: None
+ * Return Value: None
+ */
+static void fpu_save(uint8_t* state) {
+    if (fxsr_present)
+        asm volatile ("fxsave (%0)" : : "r"(state) : "memory");
+    else
+        asm volatile ("fnsave (%0)" : : "r"(state) : "memory");
+}
+
+/* fpu_restore(uint8_t* state)
+ *
+ * Description: load the fpu/SSE registers from an image saved by fpu_save
+ * Inputs: state -- source image
+ * Outputs: None
+ * Return Value: None
+ */
+static void fpu_restore(uint8_t* state) {
+    if (fxsr_present)
+        asm volatile ("fxrstor (%0)" : : "r"(state) : "memory");
+    else
+        asm volatile ("frstor (%0)" : : "r"(state) : "memory");
+}
+
+/* fpu_disable()
+ *
+ * Description: set CR0.TS so the next fpu instruction raises #NM
+ * Inputs: None
+ * Outputs: None
+ * Return Value: None
+ */
+static void fpu_disable() {
+    asm volatile (
+        "movl %%cr0, %%eax;"
+        "orl %0, %%eax;"
+        "movl %%eax, %%cr0;"
+        :
+        : "i"(CR0_TS)
+        : "eax"
+    );
+}
+
+/*
+ * void fpu_init();
+ * Inputs: None
+ * Return Value: None
+ * Function: turn off fpu emulation, enable fxsave and SSE if the CPU has
+ *           them, save the clean state and leave TS set so the first
+ *           process touching the fpu traps into fpu_trap
+ */
+void fpu_init() {
+    uint32_t eax = 1, ebx, ecx, edx;
+    uint32_t mxcsr = MXCSR_DEFAULT;
+    asm volatile ("cpuid"
+        : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+    );
+    fxsr_present = (edx & CPUID_FXSR) != 0;
+
+    asm volatile (
+        "movl %%cr0, %%eax;"
+        "andl %0, %%eax;"
+        "orl %1, %%eax;"
+        "movl %%eax, %%cr0;"
+        :
+        : "i"(~(CR0_EM | CR0_TS)), "i"(CR0_MP | CR0_NE)
+        : "eax"
+    );
+    if (fxsr_present) {
+        asm volatile (
+            "movl %%cr4, %%eax;"
+            "orl %0, %%eax;"
+            "movl %%eax, %%cr4;"
+            :
+            : "r"((edx & CPUID_SSE) ? CR4_OSFXSR | CR4_OSXMMEXCPT : CR4_OSFXSR)
+            : "eax"
+        );
+    }
+
+    asm volatile ("fninit");
+    if (edx & CPUID_SSE)
+        asm volatile ("ldmxcsr %0" : : "m"(mxcsr));
+    fpu_save(fpu_clean);
+    fpu_owner = NULL;
+    fpu_disable();
+}
+
+/*
+ * void fpu_switch(pcb_t* next_pcb);
+ * Inputs: pcb_t* next_pcb -- process about to run
+ * Return Value: None
+ * Function: leave the fpu usable only if next_pcb's state is already
+ *           loaded, any other process traps on its first fpu instruction
+ */
+void fpu_switch(pcb_t* next_pcb) {
+    if (next_pcb == fpu_owner) {
+        asm volatile ("clts");
+        return;
+    }
+    fpu_disable();
+}
+
+/*
+ * void fpu_release(pcb_t* pcb);
+ * Inputs: pcb_t* pcb -- halting process
+ * Return Value: None
+ * Function: drop the registers of a process that will never run again so
+ *           they are not saved over the next process in the same slot, and
+ *           make whoever runs next trap on its first fpu instruction
+ */
+void fpu_release(pcb_t* pcb) {
+    if (fpu_owner == pcb)
+        fpu_owner = NULL;
+    fpu_disable();
+}
+
+/*
+ * void fpu_trap();
+ * Inputs: None
+ * Return Value: None
+ * Function: #NM handler. Save the registers of the previous owner, then
+ *           load the current process's image, or the clean state if it
+ *           never used the fpu before.
+ */
+void fpu_trap() {
+    pcb_t* cur_pcb = get_pcb();
+
+    asm volatile ("clts");
+    if (fpu_owner == cur_pcb)
+        return;
+    if (fpu_owner != NULL) {
+        fpu_save(fpu_state(fpu_owner));
+        fpu_owner->fpu_used = 1;
+    }
+    fpu_restore(cur_pcb->fpu_used ? fpu_state(cur_pcb) : fpu_clean);
+    fpu_owner = cur_pcb;
+}
@@ -0,0 +1,26 @@
+#ifndef _FPU_H
+#define _FPU_H
+
+#include "types.h"
+#include "system_calls.h"
+
+#define CR0_MP          0x02        // wait/fwait honours TS
+#define CR0_EM          0x04        // emulate the fpu, must be clear for SSE
+#define CR0_TS          0x08        // task switched, next fpu use raises #NM
+#define CR0_NE          0x20        // report x87 errors through exception 16
+#define CR4_OSFXSR      0x200       // fxsave/fxrstor and SSE enabled
+#define CR4_OSXMMEXCPT  0x400       // SIMD errors raise exception 19
+#define CPUID_FXSR      (1 << 24)
+#define CPUID_SSE       (1 << 25)
+#define MXCSR_DEFAULT   0x1F80      // all SIMD exceptions masked, round to nearest
+
+/* Enable the fpu and SSE and capture the clean state new processes start with */
+void fpu_init();
+/* Set or clear CR0.TS for the process about to run */
+void fpu_switch(pcb_t* next_pcb);
+/* Forget the fpu state of a halting process */
+void fpu_release(pcb_t* pcb);
+/* #NM handler, hand the fpu to the current process */
+void fpu_trap();
+
+#endif
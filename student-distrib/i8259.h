@@ -30,6 +30,7 @@
 // device irq numbers
 #define KEYBOARD_IRQ_NUM    1		//IRQ number for keyboard
 #define SLAVE_IRQ_NUM       2		//IRQ number for slave
+#define SERIAL_IRQ_NUM      4		//IRQ number for COM1
 #define RTC_IRQ_NUM         8		//IRQ number for RTC
 
 /* Externally-visible functions */
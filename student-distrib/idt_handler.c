@@ -2,6 +2,10 @@
 #include "lib.h"
 #include "rtc.h"
 #include "system_calls.h"
+#include "paging.h"
+#include "fpu.h"
+
+#define PF_PRESENT  0x1   // page fault error code: protection violation
 
 
 
@@ -124,15 +128,15 @@ void Invalid_opcode_exception(){
 
 /* Device_not_available_exception
  *
- * Description: be called when device not available happen and let program stop
+ * Description: be called when a process uses the fpu while CR0.TS is set;
+ *              switch the fpu state over to it and retry the instruction
  * Inputs: None
  * Outputs: None
  * Return Value: None
- * Side Effects: stop the program
+ * Side Effects: the previous owner's fpu state is saved to its pcb
  */
 void Device_not_available_exception(){
-  printf("Device not available exception\n");		//print the exception on screen
-  while(1){}		//stop the program
+  fpu_trap();
 }
 
 /* Double_fault_exception
@@ -216,19 +220,24 @@ void General_protection_exception(){
 
 /* Page_fault_exception
  *
- * Description: be called when page fault exception happen and let program close and return to last program
- * Inputs: None
+ * Description: be called when page fault exception happen; map a demand-zero
+ *              page for heap and mmap faults, otherwise let program close and
+ *              return to last program
+ * Inputs: error_code -- error code pushed by the processor
  * Outputs: None
  * Return Value: None
  * Side Effects: return to last program
  */
-void Page_fault_exception(){
+void Page_fault_exception(uint32_t error_code){
   uint32_t cr2_addr;
   asm volatile (
       // CR2 contains the 32-bit addr that caused the fault
       "movl %%cr2, %0;"
       :"=r" (cr2_addr)
     );
+  // not-present fault inside the heap or an mmap area
+  if (!(error_code & PF_PRESENT) && handle_demand_fault(cr2_addr) == 0)
+    return;
   printf("Page fault exception at 0x%x \n", cr2_addr);		//print the exception on screen
   pcb_t* cur_pcb = get_pcb();
   // the program dies because of an exception
@@ -53,8 +53,8 @@ extern void Stack_fault_exception();
 /* exception for general protection and stops the program */
 extern void General_protection_exception();
 
-/* exception for page fault and stops the program */
-extern void Page_fault_exception();
+/* exception for page fault, maps demand-zero pages or stops the program */
+extern void Page_fault_exception(uint32_t error_code);
 
 /* exception for floating point error and stops the program */
 extern void Floating_point_error();
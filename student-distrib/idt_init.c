@@ -74,6 +74,13 @@ void idt_init(){
     idt[RTC].reserved3 = 0;
     SET_IDT_ENTRY(idt[RTC], rtc_linkage);//set offset for rtc (linkage)
 
+// serial interrupt
+    idt[SERIAL].present = 1; // to be present
+    idt[SERIAL].size = 1;// make it to interrupt gate
+    idt[SERIAL].reserved2 = 1;
+    idt[SERIAL].reserved3 = 0;
+    SET_IDT_ENTRY(idt[SERIAL], serial_linkage);//set offset for COM1 (linkage)
+
 // pit interrupt
     idt[PIT].present = 1; // to be present
     idt[PIT].size = 1;// make it to interrupt gate
@@ -90,14 +97,16 @@ SET_IDT_ENTRY(idt[3], Breakpoint_exception); // for Breakpoint exception
 SET_IDT_ENTRY(idt[4], Overflow_exception);  // for Overflow exception
 SET_IDT_ENTRY(idt[5], BOUND_range_exceeded_exception); // for BOUND range exceeded exception
 SET_IDT_ENTRY(idt[6], Invalid_opcode_exception); // for Invalid opcode exception
-SET_IDT_ENTRY(idt[7], Device_not_available_exception); // for Device not available exception
+SET_IDT_ENTRY(idt[7], device_na_linkage); // for Device not available exception
+idt[7].size = 1; // 32-bit gate, the handler returns after loading the fpu state
 SET_IDT_ENTRY(idt[8], Double_fault_exception); // for Double fault exception
 SET_IDT_ENTRY(idt[9], Coprocessor_segment_overrun); // for Coprocessor segment overrun
 SET_IDT_ENTRY(idt[10], Invalid_TSS_exception); // for Invalid TSS exception
 SET_IDT_ENTRY(idt[11], Segment_not_present); // for Segment not present
 SET_IDT_ENTRY(idt[12], Stack_fault_exception); // for Stack fault exception
 SET_IDT_ENTRY(idt[13], General_protection_exception); // for General protection exception
-SET_IDT_ENTRY(idt[14], Page_fault_exception); // for Page fault exception
+SET_IDT_ENTRY(idt[14], page_fault_linkage); // for Page fault exception
+idt[14].size = 1; // 32-bit gate, the handler returns for demand-zero faults
 // idt[15] reserved by INTEL
 SET_IDT_ENTRY(idt[16], Floating_point_error); // for Floating point error
 SET_IDT_ENTRY(idt[17], Alignment_check_exception); // for Alignment check exception
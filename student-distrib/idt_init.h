@@ -4,6 +4,7 @@
 #define SYSTEM_CALL       0x80
 #define KEYBOARD          0x21
 #define RTC               0x28
+#define SERIAL            0x24
 #define PIT               0x20              
 #define DEFINE_INTERRUPT  32
 
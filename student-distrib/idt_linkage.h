@@ -9,12 +9,21 @@ extern void keyboard_linkage();
 /* Save all current registers and call rtc handler */
 extern void rtc_linkage();
 
+/* Save all current registers and call serial handler */
+extern void serial_linkage();
+
 /* Save all current registers and call system call handler */
 extern void system_linkage();
 
 /* Save all current registers and call rtc handler */
 extern void pit_linkage();
 
+/* Save all current registers and call page fault handler */
+extern void page_fault_linkage();
+
+/* Save all current registers and call device not available handler */
+extern void device_na_linkage();
+
 #endif
 
 #endif
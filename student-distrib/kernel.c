@@ -15,6 +15,10 @@
 #include "system_calls.h"
 #include "schedule.h"
 #include "terminal.h"
+#include "fpu.h"
+#include "keyboard.h"
+#include "fb.h"
+#include "serial.h"
 
 
 
@@ -25,6 +29,27 @@
 #define CHECK_FLAG(flags, bit)   ((flags) & (1 << (bit)))
 
 
+/* cmdline_has
+*
+* Description: look for a word among the space separated kernel arguments
+* Inputs: cmdline -- command line from the boot loader
+*         word -- argument to find
+* Outputs: None
+* Return Value: 1 if word is one of the arguments, 0 otherwise
+*/
+static int32_t cmdline_has(const int8_t* cmdline, const int8_t* word) {
+    uint32_t len = strlen(word);
+    while (*cmdline != '\0') {
+        while (*cmdline == ' ')
+            cmdline++;
+        if (strncmp(cmdline, word, len) == 0 && (cmdline[len] == ' ' || cmdline[len] == '\0'))
+            return 1;
+        while (*cmdline != '\0' && *cmdline != ' ')
+            cmdline++;
+    }
+    return 0;
+}
+
 /* entry
 *
 * Description: Check if MAGIC is valid and print the Multiboot information structure
@@ -37,6 +62,7 @@
 void entry(unsigned long magic, unsigned long addr) {
 
     multiboot_info_t *mbi;
+    int32_t want_fb = 0;
 
     /* Clear the screen. */
     clear();
@@ -62,8 +88,11 @@ void entry(unsigned long magic, unsigned long addr) {
         printf("boot_device = 0x%#x\n", (unsigned)mbi->boot_device);
 
     /* Is the command line passed? */
-    if (CHECK_FLAG(mbi->flags, 2))
+    if (CHECK_FLAG(mbi->flags, 2)) {
         printf("cmdline = %s\n", (char *)mbi->cmdline);
+        // "vbe" switches the console to a linear framebuffer
+        want_fb = cmdline_has((int8_t*)mbi->cmdline, "vbe");
+    }
 
     if (CHECK_FLAG(mbi->flags, 3)) {
         int mod_count = 0;
@@ -157,6 +186,9 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Init the IDT*/
     idt_init();
 
+    /* Enable the FPU and SSE, switched lazily through #NM */
+    fpu_init();
+
     // Initialize Paging
     page_init();
 
@@ -169,13 +201,21 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Init the RTC */
     rtc_init();
 
+    /* Init COM1, from here on kernel output is mirrored to it */
+    if (serial_init() == -1)
+        printf("No serial port on COM1\n");
+
     /* Init the PIT */
     terminal_init();
+
+    /* Switch to the framebuffer console if asked to */
+    if (want_fb && fb_init() == -1)
+        printf("No VBE display, staying in text mode\n");
     /* Initialize devices, memory, filesystem, enable device interrupts on the
      * PIC, any other initialization stuff... */
 
     /* Enable interrupts */
-    enable_irq(KEYBOARD_IRQ_NUM); // enable keyboard IRQ
+    keyboard_init(); // enable keyboard IRQ and its bottom half
     enable_irq(RTC_IRQ_NUM); // enable RTC IRQ
     enable_irq(SLAVE_IRQ_NUM); // enable SLAVE IRQ
 
@@ -185,6 +225,7 @@ void entry(unsigned long magic, unsigned long addr) {
      * IDT correctly otherwise QEMU will triple fault and simple close
      * without showing you any output */
     printf("Enabling Interrupts\n");
+    idle_init();
     sti();
 
 
@@ -194,6 +235,8 @@ void entry(unsigned long magic, unsigned long addr) {
 #endif
     /* Execute the first program ("shell") ... */
 
-    /* Spin (nicely, so we don't chew up cycles) */
-    asm volatile (".1: hlt; jmp .1;");
+    /* Become the idle task: halt (nicely, so we don't chew up cycles)
+     * whenever no process is runnable, zeroing free page frames between
+     * interrupts so allocations find them ready */
+    idle_task();
 }
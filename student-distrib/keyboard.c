@@ -3,6 +3,7 @@
 #include "idt_handler.h"
 #include "lib.h"
 #include "i8259.h"
+#include "softirq.h"
 
 #define ON    1
 #define OFF   0
@@ -16,6 +17,12 @@ int caps_flag[TERMINAL_COUNT] = {OFF, OFF, OFF};
 int ctrl_flag[TERMINAL_COUNT] = {OFF, OFF, OFF};
 int alt_flag= OFF;
 
+// scancodes read by the interrupt, waiting for keyboard_bh. Only the
+// interrupt moves scancode_tail and only the bottom half scancode_head, so
+// neither side needs a lock; both count freely and wrap with the modulo.
+static uint8_t scancode_queue[SCANCODE_QUEUE_SIZE];
+static volatile uint32_t scancode_head, scancode_tail;
+
 // keyboard http://www.plantation-productions.com/Webster/www.artofasm.com/DOS/pdf/apndxc.pdf
 static uint8_t keyboard_map[KEY_ARRAY_ROW][KEY_ARRAY_COL] = {
 	// no caps and no shift
@@ -42,30 +49,42 @@ static uint8_t keyboard_map[KEY_ARRAY_ROW][KEY_ARRAY_COL] = {
 
 /* keyboard_handler
  *
- * Description: handler for keyboard, read character from keyboard and
- * 				put the character on screen
+ * Description: handler for keyboard, read the scancode and queue it for
+ * 				keyboard_bh, which decodes it with interrupts enabled
  * Inputs: None
  * Outputs: None
  * Return Value: None
- * Side Effects: Show the character read from keyboard on screen
+ * Side Effects: raises SOFTIRQ_KEYBOARD
  */
 void keyboard_handler(){
-    uint32_t word;
-    word = inb(KEYBOARD_PORT);		//get the character from keyboard
-		// loop forever until it breaks
-    while(1){
-			// check if character is out of range/ invalid
-      if (word <= 0) {
-        word = inb(KEYBOARD_PORT); // check for next input
-      }
-      else break;
+    uint8_t word = inb(KEYBOARD_PORT);		//get the character from keyboard
+    // drop the key if the bottom half is that far behind
+    if (word != 0 && scancode_tail - scancode_head < SCANCODE_QUEUE_SIZE) {
+      scancode_queue[scancode_tail % SCANCODE_QUEUE_SIZE] = word;
+      // publish the scancode before the slot
+      asm volatile ("" : : : "memory");
+      scancode_tail++;
     }
+    raise_softirq(SOFTIRQ_KEYBOARD);
+    send_eoi(KEYBOARD_IRQ_NUM);		//send EOI with keyboard IRQ number
+}
 
+/* keyboard_process
+ *
+ * Description: act on one scancode: update the modifier flags, switch
+ * 				terminals or echo the key
+ * Inputs: word -- scancode read from the keyboard
+ * Outputs: None
+ * Return Value: None
+ * Side Effects: Show the character read from keyboard on screen
+ */
+static void keyboard_process(uint32_t word){
+    uint32_t flags;
+    spin_lock_irqsave(&console_lock, flags);
   	//show the character on screen
     switch(word){ //to decide which case to choose according to key
 			case ENTER:
-				enter_count[screen_terminal]++;
-				enter();
+				ldisc_input(screen_terminal, '\n');
 				break;
 
       case L_SHIFT_DOWN:
@@ -97,7 +116,7 @@ void keyboard_handler(){
         break;
 
       case BACK:
-        backspace();
+        ldisc_input(screen_terminal, '\b');
         break;
 
 			case ALT_DOWN:
@@ -133,12 +152,42 @@ void keyboard_handler(){
 				}
 				break;
 
+      case PAGE_UP:
+        // shift+page up shows older output
+        if (shift_flag[screen_terminal] == ON)
+          scrollback(SCROLLBACK_STEP);
+        break;
+
+      case PAGE_DOWN:
+        if (shift_flag[screen_terminal] == ON)
+          scrollback(-SCROLLBACK_STEP);
+        break;
+
       default:
         display_key(word);
         break;
       }
+    spin_unlock_irqrestore(&console_lock, flags);
+}
 
-    send_eoi(KEYBOARD_IRQ_NUM);		//send EOI with keyboard IRQ number
+/* keyboard_bh
+ *
+ * Description: bottom half for keyboard, decode the queued scancodes and
+ * 				put the characters on screen
+ * Inputs: None
+ * Outputs: None
+ * Return Value: None
+ * Side Effects: Show the character read from keyboard on screen
+ */
+void keyboard_bh(){
+    uint32_t word;
+    while (scancode_head != scancode_tail) {
+      word = scancode_queue[scancode_head % SCANCODE_QUEUE_SIZE];
+      // read the scancode before handing the slot back
+      asm volatile ("" : : : "memory");
+      scancode_head++;
+      keyboard_process(word);
+    }
 }
 
 /* display_key
@@ -147,8 +196,8 @@ void keyboard_handler(){
  * Inputs: the correpsonding hex value of the key
  * Outputs: correpsonding key to be displayed
  * Return Value: None
- * Side Effects: Show the character read from keyboard on screen and
- *							 also add character to the text buffer if within range
+ * Side Effects: Hand the character to the line discipline of the screen
+ *							 terminal, which echoes it
  */
 void display_key(uint32_t word) {
     if (word >= KEY_ARRAY_COL)    return; //check if out of bound
@@ -169,17 +218,9 @@ void display_key(uint32_t word) {
         set_text_pos(0, 0, screen_terminal);	// set cursor to the upper left corner position
     }
 
-    else{
-				if (key_buffer_index[screen_terminal] < KEYBOARD_BUFFER_SIZE-1)  { // if within range then add to text buffer
-		        keyboard_buffer[screen_terminal][key_buffer_index[screen_terminal]] = key;
-						key_buffer_index[screen_terminal]++;
-						putkey(key, screen_terminal);
-						update_cursor();
-		    }
-				if (term_buffer_index[screen_terminal] < KEYBOARD_BUFFER_SIZE-1)  { // if within range then add to text buffer
-						terminal_buffer[screen_terminal][term_buffer_index[screen_terminal]] = key;
-						term_buffer_index[screen_terminal]++;
-				}
+    else if (key != '\0') {
+				// the line discipline buffers and echoes the key
+				ldisc_input(screen_terminal, key);
 		}
 }
 
@@ -193,62 +234,6 @@ void display_key(uint32_t word) {
  * Side Effects: Enable the keyboard irq
  */
 void keyboard_init() {
+  open_softirq(SOFTIRQ_KEYBOARD, keyboard_bh);
   enable_irq(KEYBOARD_IRQ_NUM);
 }
-
-/* backspace
- *
- * Description: to handle the case if the pressed key is backspace
- * Inputs: None
- * Outputs: None
- * Return Value: None
- * Side Effects: The cursor will move to a character ahead and the previous
- *							character will be cleared
- */
-void backspace() {
-		if (key_buffer_index[screen_terminal] > 0) {
-        remove_char(key_buffer_index[screen_terminal]);
-        key_buffer_index[screen_terminal]--;
-        keyboard_buffer[screen_terminal][key_buffer_index[screen_terminal]] = NULL; // set previous character to NULL
-    }
-		if (term_buffer_index[screen_terminal] > 0 && tread_mode[screen_terminal] == 1) {
-        term_buffer_index[screen_terminal]--;
-        terminal_buffer[screen_terminal][term_buffer_index[screen_terminal]] = NULL; // set previous character to NULL
-    }
-}
-
-/* clear_buffer
- *
- * Description: to clear the text buffer
- * Inputs: None
- * Outputs: None
- * Return Value: None
- * Side Effects: clear the text buffer
- */
-void clear_buffer() {
-	// set all buffer characters to NULL
-	int i = 0;
-	for (i = 0; i < key_buffer_index[screen_terminal]; i++) {
-		keyboard_buffer[screen_terminal][i] = NULL;
-	}
-	// initialize buffer indices to default zeros
-	key_buffer_index[screen_terminal] = 0;
-}
-
-/* enter
- *
- * Description: to handle the case if the pressed key is enter
- * Inputs: None
- * Outputs: None
- * Return Value: None
- * Side Effects: The cursor will move to a new line and the text buffer
- *							 will be cleared
- */
-void enter() {
-		clear_buffer();
-		if(term_buffer_index[screen_terminal] < KEYBOARD_BUFFER_SIZE) {
-				terminal_buffer[screen_terminal][term_buffer_index[screen_terminal]] = '\n'; // save '\n' into terminal buffer
-				term_buffer_index[screen_terminal]++;
-		}
-    enter_lib(screen_terminal);
-}
@@ -8,6 +8,7 @@
 #define KEY_ARRAY_COL	60			//number of columns of the keyboard array
 #define KEY_ARRAY_ROW	4			//number of rows of the keyboard array
 #define KEYBOARD_BUFFER_SIZE 128 // add one for \n
+#define SCANCODE_QUEUE_SIZE  16  // scancodes waiting for the bottom half, a power of two
 
 #define L_SHIFT_DOWN 0x2A
 #define L_SHIFT_UP   0xAA
@@ -23,9 +24,9 @@
 #define F1           0x3B
 #define F2           0x3C
 #define F3           0x3D
-
-//test buffer for terminal
-volatile uint8_t keyboard_buffer[3][KEYBOARD_BUFFER_SIZE];
+#define PAGE_UP      0x49
+#define PAGE_DOWN    0x51
+#define SCROLLBACK_STEP 12 // lines moved by Shift+PageUp/PageDown
 
 // keyboard flags for all three terminals
 extern int shift_flag[3];
@@ -40,20 +41,15 @@ extern int alt_flag;
 /* handler for keyboard */
 extern void keyboard_handler();
 
+/* bottom half for keyboard */
+extern void keyboard_bh();
+
 /* initialize keyboard*/
 extern void keyboard_init();
 
-/* function to handle backspace*/
-extern void backspace();
-
-/* function to handle enter*/
-extern void enter();
-
 /* display key to screen*/
 extern void display_key(uint32_t word);
 
-/* clear text buffer*/
-extern void clear_buffer();
 
 #endif
 #endif
@@ -4,6 +4,8 @@
 #include "lib.h"
 #include "terminal.h"
 #include "paging.h"
+#include "fb.h"
+#include "serial.h"
 
 
 #define VIDEO                 0xB8000
@@ -11,18 +13,146 @@
 #define NUM_ROWS              25
 #define ATTRIB                0x7
 #define KEYBOARD_BUFFER_SIZE  128
-#define VID_B0                0xB9000
-#define VID_B1                0xBA000
-#define VID_B2                0xBB000
-#define _4KB                  0x1000
-#define VM_END_ADDR           0x8400000  // 132 MB
+#define BLANK_CELL            ((ATTRIB << 8) | ' ')
+#define ESC                   0x1B
+#define ESC_MAX_PARAMS        8     // numbers kept from one control sequence
+#define ESC_MAX_VALUE         9999
+#define ATTRIB_BRIGHT         0x08  // high intensity foreground
+#define REGION_CELLS          (TERM_VIDEO_SIZE / 2)   // cells of text memory each terminal scrolls through
+#define VIEW_PAGE             (text_mem + TERMINAL_COUNT * TERM_VIDEO_SIZE) // scrollback is drawn here
+#define TEXT_MEM_SIZE         ((TERMINAL_COUNT + 1) * TERM_VIDEO_SIZE)
+#define SCROLLBACK_LINES      256   // lines of history kept per terminal
+#define CRTC_INDEX            0x3D4
+#define CRTC_DATA             0x3D5
+#define CRTC_START_HIGH       0x0C
+#define CRTC_START_LOW        0x0D
 
 static int screen_x;
 static int screen_y;
-static char* video_mem = (char *)VIDEO;
 int prev_x[KEYBOARD_BUFFER_SIZE];
 // initial auto entering flags to default zeros for all terminals
 int auto_flag[TERMINAL_COUNT] = {0, 0, 0};
+// cell offset of each terminal's first visible row inside its region
+static uint32_t origin[TERMINAL_COUNT];
+// lines scrolled off the top of each terminal, a ring of characters only;
+// the history is shown in the default colors
+static uint8_t history[TERMINAL_COUNT][SCROLLBACK_LINES][NUM_COLS];
+// next history line to fill and number of lines filled
+static uint32_t history_head[TERMINAL_COUNT];
+static uint32_t history_count[TERMINAL_COUNT];
+// lines the screen terminal is scrolled back, 0 while showing live output
+static uint32_t view_lines;
+// text memory of the terminals and the scrollback view, VGA text memory
+// until the framebuffer console moves it to text_ram
+static uint8_t* text_mem = (uint8_t*)VIDEO;
+static uint8_t text_ram[TEXT_MEM_SIZE] __attribute__((aligned(4096)));
+// cell offset from text_mem of the first cell shown
+static uint32_t shown_start;
+
+// where a terminal is inside an escape sequence
+enum { ESC_NORMAL, ESC_ESCAPE, ESC_CSI };
+// escape sequence parser and colors of a terminal's write path
+typedef struct {
+    uint8_t state;                      // ESC_NORMAL, ESC_ESCAPE or ESC_CSI
+    uint8_t nparams;                    // numbers seen so far in a CSI sequence
+    uint16_t params[ESC_MAX_PARAMS];
+    uint8_t attrib;                     // attribute of new and erased cells
+    uint8_t saved_x;                    // position stored by ESC 7 or CSI s
+    uint8_t saved_y;
+} ansi_t;
+static ansi_t ansi[TERMINAL_COUNT] = {
+    {ESC_NORMAL, 0, {0}, ATTRIB, 0, 0},
+    {ESC_NORMAL, 0, {0}, ATTRIB, 0, 0},
+    {ESC_NORMAL, 0, {0}, ATTRIB, 0, 0}
+};
+
+static void end_view(uint8_t term_num);
+
+
+/* void set_start(uint32_t cells);
+ * Inputs: cells -- offset in cells from VIDEO of the first cell to show
+ * Return Value: none
+ * Function: Point the CRTC start address at a new window of video memory */
+static void set_start(uint32_t cells) {
+    shown_start = cells;
+    // the framebuffer is redrawn with the cursor
+    if (fb_enabled)
+        return;
+    outb(CRTC_START_HIGH, CRTC_INDEX);
+    outb((uint8_t) ((cells >> 8) & 0xFF), CRTC_DATA);
+    outb(CRTC_START_LOW, CRTC_INDEX);
+    outb((uint8_t) (cells & 0xFF), CRTC_DATA);
+}
+
+/* void set_origin(uint8_t term_num, uint32_t cells);
+ * Inputs: term_num -- terminal whose window moves
+ *         cells -- offset in cells of its new first visible row
+ * Return Value: none
+ * Function: Move a terminal's window inside its region, and the screen with
+ *           it if the terminal is shown */
+static void set_origin(uint8_t term_num, uint32_t cells) {
+    origin[term_num] = cells;
+    if (term_num == screen_terminal && view_lines == 0)
+        set_start(term_num * REGION_CELLS + cells);
+}
+
+/* uint16_t* term_region(uint8_t term_num);
+ * Inputs: term_num -- terminal
+ * Return Value: first cell of the text memory the terminal owns
+ * Function: Locate a terminal's region of video memory */
+static uint16_t* term_region(uint8_t term_num) {
+    return (uint16_t*)(text_mem + term_num * TERM_VIDEO_SIZE);
+}
+
+/* uint32_t term_video_addr(uint8_t term_num);
+ * Inputs: term_num -- terminal
+ * Return Value: physical address of the text memory the terminal owns
+ * Function: Locate a terminal's region for vidmap */
+uint32_t term_video_addr(uint8_t term_num) {
+    return (uint32_t)term_region(term_num);
+}
+
+/* void console_use_ram();
+ * Inputs: None
+ * Return Value: None
+ * Function: Move the text of all terminals from VGA text memory to RAM,
+ *           for the framebuffer console, and draw the screen from there */
+void console_use_ram() {
+    memcpy(text_ram, text_mem, TEXT_MEM_SIZE);
+    text_mem = text_ram;
+    update_cursor();
+}
+
+/* void console_sync();
+ * Inputs: None
+ * Return Value: None
+ * Function: Redraw the framebuffer from the text of the screen terminal
+ *           when a vidmap program may have written it behind our back.
+ *           Called periodically from the RTC bottom half. */
+void console_sync() {
+    uint32_t flags;
+    if (!fb_enabled || terminal[screen_terminal].fish_check == 0)
+        return;
+    spin_lock_irqsave(&console_lock, flags);
+    update_cursor();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+/* uint16_t* term_cells(uint8_t term_num);
+ * Inputs: term_num -- terminal being drawn
+ * Return Value: first cell of the terminal's visible window
+ * Function: Locate row 0 of a terminal */
+static uint16_t* term_cells(uint8_t term_num) {
+    return term_region(term_num) + origin[term_num];
+}
+
+/* uint16_t blank_cell(uint8_t term_num);
+ * Inputs: term_num -- terminal
+ * Return Value: an empty cell in the terminal's current colors
+ * Function: Cell used to erase and scroll */
+static uint16_t blank_cell(uint8_t term_num) {
+    return (ansi[term_num].attrib << 8) | ' ';
+}
 
 
 /* void clear(void);
@@ -30,12 +160,34 @@ int auto_flag[TERMINAL_COUNT] = {0, 0, 0};
  * Return Value: none
  * Function: Clears video memory */
 void clear(void) {
-    map_video_page((uint32_t)video_mem);
-    int32_t i;
-    for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
-        *(uint8_t *)(video_mem + (i << 1)) = ' ';
-        *(uint8_t *)(video_mem + (i << 1) + 1) = ATTRIB;
+    end_view(screen_terminal);
+    set_origin(screen_terminal, 0);
+    memset_word(term_cells(screen_terminal), blank_cell(screen_terminal), NUM_ROWS * NUM_COLS);
+}
+
+/* void kputc(uint8_t c);
+ * Inputs: c -- character to print
+ * Return Value: none
+ * Function: Write one character of kernel output to the screen terminal
+ *           and COM1. printf and puts send everything through here. The caller
+ *           holds console_lock. */
+static void kputc(uint8_t c) {
+    // kernel output is mirrored to COM1
+    serial_putc(c);
+    putkey(c, screen_terminal);
+}
+
+/* int32_t kputs(int8_t* s);
+ * Inputs: s -- string to print
+ * Return Value: Number of bytes written
+ * Function: puts for callers already holding console_lock */
+static int32_t kputs(int8_t* s) {
+    register int32_t index = 0;
+    while (s[index] != '\0') {
+        kputc(s[index]);
+        index++;
     }
+    return index;
 }
 
 /* Standard printf().
@@ -64,6 +216,9 @@ int32_t printf(int8_t *format, ...) {
     int32_t* esp = (void *)&format;
     esp++;
 
+    uint32_t flags;
+    spin_lock_irqsave(&console_lock, flags);
+
     while (*buf != '\0') {
         switch (*buf) {
             case '%':
@@ -76,7 +231,7 @@ format_char_switch:
                     switch (*buf) {
                         /* Print a literal '%' character */
                         case '%':
-                            putkey('%', screen_terminal);
+                            kputc('%');
                             break;
 
                         /* Use alternate formatting */
@@ -94,7 +249,7 @@ format_char_switch:
                                 int8_t conv_buf[64];
                                 if (alternate == 0) {
                                     itoa(*((uint32_t *)esp), conv_buf, 16);
-                                    puts(conv_buf);
+                                    kputs(conv_buf);
                                 } else {
                                     int32_t starting_index;
                                     int32_t i;
@@ -104,7 +259,7 @@ format_char_switch:
                                         conv_buf[i] = '0';
                                         i++;
                                     }
-                                    puts(&conv_buf[starting_index]);
+                                    kputs(&conv_buf[starting_index]);
                                 }
                                 esp++;
                             }
@@ -115,7 +270,7 @@ format_char_switch:
                             {
                                 int8_t conv_buf[36];
                                 itoa(*((uint32_t *)esp), conv_buf, 10);
-                                puts(conv_buf);
+                                kputs(conv_buf);
                                 esp++;
                             }
                             break;
@@ -131,20 +286,20 @@ format_char_switch:
                                 } else {
                                     itoa(value, conv_buf, 10);
                                 }
-                                puts(conv_buf);
+                                kputs(conv_buf);
                                 esp++;
                             }
                             break;
 
                         /* Print a single character */
                         case 'c':
-                            putkey((uint8_t) *((int32_t *)esp), screen_terminal);
+                            kputc((uint8_t) *((int32_t *)esp));
                             esp++;
                             break;
 
                         /* Print a NULL-terminated string */
                         case 's':
-                            puts(*((int8_t **)esp));
+                            kputs(*((int8_t **)esp));
                             esp++;
                             break;
 
@@ -156,71 +311,86 @@ format_char_switch:
                 break;
 
             default:
-                putkey(*buf, screen_terminal);
+                kputc(*buf);
                 break;
         }
         buf++;
     }
+    spin_unlock_irqrestore(&console_lock, flags);
     return (buf - format);
 }
 
-/* void switch_term(uint8_t new_term)
- *   Inputs: new_term -- the terminal id to switch to
+/* void end_view(uint8_t term_num)
+ *   Inputs: term_num -- terminal about to be drawn
  *   Return Value: None
- *   Function: switch to the corresponding terminal and remap video mem page
+ *   Function: leave scrollback if term_num is the terminal being viewed and
+ *             show its live window again
  */
-void switch_term(uint8_t new_term) {
-    int i;
-    map_video_page((uint32_t)VIDEO);
-    // check current screen terminal and map to video mem address
-    switch(screen_terminal) {
-        case 0:
-            map_video_page((uint32_t)VID_B0);
-            memcpy((char*)VID_B0,(char*)VIDEO, _4KB);
-            break;
-
-        case 1:
-            map_video_page((uint32_t)VID_B1);
-            memcpy((char*)VID_B1,(char*)VIDEO, _4KB);
-            break;
-
-        case 2:
-            map_video_page((uint32_t)VID_B2);
-            memcpy((char*)VID_B2,(char*)VIDEO, _4KB);
-            break;
+static void end_view(uint8_t term_num) {
+    if (term_num != screen_terminal || view_lines == 0)
+        return;
+    view_lines = 0;
+    set_start(term_num * REGION_CELLS + origin[term_num]);
+}
 
-        default:
-            break;
+/* void scrollback(int32_t lines)
+ *   Inputs: lines -- lines to move back into the history, negative to move
+ *                    towards the live output
+ *   Return Value: None
+ *   Function: show older output of the screen terminal. The view is drawn in
+ *             its own page so the live text is left alone. The caller holds
+ *             console_lock; any output to the terminal ends the view.
+ */
+void scrollback(int32_t lines) {
+    uint8_t term_num = screen_terminal;
+    int32_t view = (int32_t)view_lines + lines;
+    uint16_t* screen = (uint16_t*)VIEW_PAGE;
+    uint16_t* live = term_cells(term_num);
+    uint8_t* line;
+    uint32_t row, i;
+    // a vidmap program owns the screen
+    if (terminal[term_num].fish_check != 0)
+        return;
+    if (view < 0)
+        view = 0;
+    if (view > (int32_t)history_count[term_num])
+        view = history_count[term_num];
+    if ((uint32_t)view == view_lines)
+        return;
+    if (view == 0) {
+        end_view(term_num);
+        return;
     }
+    view_lines = view;
 
-    // copy new terminal video page to video mem addr 0xB8000
-    switch(new_term) {
-        case 0:
-            map_video_page((uint32_t)VID_B0);
-            memcpy((char*)VIDEO, (char*)VID_B0, _4KB);
-            break;
-
-        case 1:
-            map_video_page((uint32_t)VID_B1);
-            memcpy((char*)VIDEO, (char*)VID_B1, _4KB);
-            break;
-
-        case 2:
-            map_video_page((uint32_t)VID_B2);
-            memcpy((char*)VIDEO, (char*)VID_B2, _4KB);
-            break;
-
-        default:
-            break;
+    for (row = 0; row < NUM_ROWS; row++) {
+        if (row < view_lines) {
+            line = history[term_num][(history_head[term_num] + SCROLLBACK_LINES - view_lines + row) % SCROLLBACK_LINES];
+            for (i = 0; i < NUM_COLS; i++)
+                screen[row * NUM_COLS + i] = (ATTRIB << 8) | line[i];
+        }
+        else {
+            memcpy(screen + row * NUM_COLS, live + (row - view_lines) * NUM_COLS, NUM_COLS * 2);
+        }
     }
-    // after swtiching to new terminal, check
-    // if the fish program is running and the video mem needs to be updated
+    set_start(TERMINAL_COUNT * REGION_CELLS);
+    update_cursor();
+}
+
+/* void switch_term(uint8_t new_term)
+ *   Inputs: new_term -- the terminal id to switch to
+ *   Return Value: None
+ *   Function: show another terminal. Every terminal draws into its own
+ *             region of video memory, so only the CRTC start address and
+ *             the cursor change.
+ */
+void switch_term(uint8_t new_term) {
+    if (new_term >= TERMINAL_COUNT)
+        return;
+    // the history view belongs to the terminal being left
+    view_lines = 0;
     screen_terminal = new_term;
-    for (i = 0; i < TERMINAL_COUNT; i++) {
-      if (terminal[i].fish_check != 0) {
-        map_video_mem(VM_END_ADDR + (i)*_4KB);
-      }
-    }
+    set_start(new_term * REGION_CELLS + origin[new_term]);
     update_cursor();
 }
 
@@ -229,12 +399,12 @@ void switch_term(uint8_t new_term) {
  *   Return Value: Number of bytes written
  *    Function: Output a string to the console */
 int32_t puts(int8_t* s) {
-    register int32_t index = 0;
-    while (s[index] != '\0') {
-        putkey(s[index], screen_terminal);
-        index++;
-    }
-    return index;
+    uint32_t flags;
+    int32_t count;
+    spin_lock_irqsave(&console_lock, flags);
+    count = kputs(s);
+    spin_unlock_irqrestore(&console_lock, flags);
+    return count;
 }
 
 /* void putc(uint8_t c);
@@ -246,8 +416,7 @@ void putc(uint8_t c) {
         screen_y++;
         screen_x = 0;
     } else {
-        *(uint8_t *)(video_mem + ((NUM_COLS * screen_y + screen_x) << 1)) = c;
-        *(uint8_t *)(video_mem + ((NUM_COLS * screen_y + screen_x) << 1) + 1) = ATTRIB;
+        *(term_cells(screen_terminal) + NUM_COLS * screen_y + screen_x) = (ATTRIB << 8) | c;
         screen_x++;
         screen_x %= NUM_COLS;
         screen_y = (screen_y + (screen_x / NUM_COLS)) % NUM_ROWS;
@@ -256,39 +425,38 @@ void putc(uint8_t c) {
 }
 
 
+/* void newline(uint8_t term_num);
+ * Inputs: term_num -- terminal to move to the next line
+ * Return Value: void
+ * Function: Move the text position to the start of the next line, scrolling
+ *           at the bottom. A newline right after an automatic wrap only
+ *           clears the wrap. Leaves the page mapping and cursor alone. */
+static void newline(uint8_t term_num) {
+    if(auto_flag[term_num] == 1 && terminal[term_num].screen_x == X_START){   // if auto entering next line was implemented and at the first position of the new line
+      auto_flag[term_num] = 0;   // set auto flag back to 0 after handling
+      return;
+    }
+    // save previous line position
+    prev_x[terminal[term_num].screen_y] = terminal[term_num].screen_x;
+    terminal[term_num].screen_x = X_START;
+    if (terminal[term_num].screen_y + ONE_LINE >= NUM_ROWS)
+      scroll(term_num);
+    else
+      terminal[term_num].screen_y++;
+}
+
 /* void putkey(uint8_t c);
  * Inputs: uint_8 c = character to print
  * Return Value: void
- * Function: Output a character to the console and set text to the right position
+ * Function: Output a character to the console and set text to the right position.
+ *           The caller holds console_lock.
  */
 void putkey(uint8_t c, uint8_t term_num) {
-  cli();
-    if(term_num == screen_terminal) {
-         map_video_page((uint32_t)video_mem);
-    }
-    else{
-        switch(term_num) {
-            case 0:
-                map_4KB_page((uint32_t)VID_B0);
-                break;
-
-            case 1:
-                map_4KB_page((uint32_t)VID_B1);
-                break;
-
-            case 2:
-                map_4KB_page((uint32_t)VID_B2);
-                break;
-
-            default:
-                break;
-        }
-    }
+    end_view(term_num);
     // if pressed key was enter, handle enter
     if (c == '\n') enter_lib(term_num);
     else{
-      *(uint8_t *)(video_mem + ((NUM_COLS * terminal[term_num].screen_y + terminal[term_num].screen_x) << CONST_OFFSET)) = c;
-      *(uint8_t *)(video_mem + ((NUM_COLS * terminal[term_num].screen_y + terminal[term_num].screen_x) << CONST_OFFSET) + CONST_OFFSET) = ATTRIB;
+      *(term_cells(term_num) + NUM_COLS * terminal[term_num].screen_y + terminal[term_num].screen_x) = (ansi[term_num].attrib << 8) | c;
       set_text_pos(terminal[term_num].screen_x + ONE_LINE, terminal[term_num].screen_y, term_num);
     }
 }
@@ -298,7 +466,7 @@ void putkey(uint8_t c, uint8_t term_num) {
  * Return Value: None
  * Function: Remove a character from the console */
 void remove_char(int buffer_index) {
-    map_video_page((uint32_t)video_mem);
+    end_view(screen_terminal);
     if (buffer_index < X_START)
         return;
     if (terminal[screen_terminal].screen_x == X_START && terminal[screen_terminal].screen_y == Y_START)
@@ -311,49 +479,244 @@ void remove_char(int buffer_index) {
         set_text_pos(terminal[screen_terminal].screen_x - ONE_LINE, terminal[screen_terminal].screen_y, screen_terminal);
     }
     // delete previous character
-    *(uint8_t *)(video_mem + ((NUM_COLS * terminal[screen_terminal].screen_y + terminal[screen_terminal].screen_x) << CONST_OFFSET)) = ' ';
-    *(uint8_t *)(video_mem + ((NUM_COLS * terminal[screen_terminal].screen_y + terminal[screen_terminal].screen_x) << CONST_OFFSET) + ONE_LINE) = ATTRIB;
+    *(term_cells(screen_terminal) + NUM_COLS * terminal[screen_terminal].screen_y + terminal[screen_terminal].screen_x) = blank_cell(screen_terminal);
+    update_cursor();
 }
 
 
 /* void enter_lib(int buffer_index);
  * Inputs: index of the buffer to be removed
  * Return Value: None
- * Function: Remove a character from the console */
+ * Function: Remove a character from the console. The caller holds console_lock. */
 void enter_lib(uint8_t term_num) {
-    cli();
-    if(term_num == screen_terminal) {
-         map_video_page((uint32_t)video_mem);
+    end_view(term_num);
+    newline(term_num);
+    if(term_num == screen_terminal){
+      update_cursor();
     }
-    else{
-        switch(term_num) {
-            case 0:
-                map_4KB_page((uint32_t)VID_B0);
-                break;
+}
 
-            case 1:
-                map_4KB_page((uint32_t)VID_B1);
-                break;
+/* void ansi_sgr(uint8_t term_num, uint32_t param);
+ * Inputs: term_num -- terminal
+ *         param -- one number of an ESC [ ... m sequence
+ * Return Value: None
+ * Function: Change the attribute byte new characters are drawn with */
+static void ansi_sgr(uint8_t term_num, uint32_t param) {
+    // ANSI color numbers in VGA attribute order
+    static const uint8_t vga_color[8] = {0, 4, 2, 6, 1, 5, 3, 7};
+    uint8_t* attrib = &ansi[term_num].attrib;
+
+    if (param == 0)
+        *attrib = ATTRIB;
+    else if (param == 1)
+        *attrib |= ATTRIB_BRIGHT;
+    else if (param == 22)
+        *attrib &= ~ATTRIB_BRIGHT;
+    else if (param == 7)
+        *attrib = ((*attrib & 0x07) << 4) | ((*attrib >> 4) & 0x07);
+    else if (param >= 30 && param <= 37)
+        *attrib = (*attrib & 0xF8) | vga_color[param - 30];
+    else if (param == 39)
+        *attrib = (*attrib & 0xF8) | (ATTRIB & 0x07);
+    else if (param >= 90 && param <= 97)
+        *attrib = (*attrib & 0xF0) | ATTRIB_BRIGHT | vga_color[param - 90];
+    else if (param >= 40 && param <= 47)
+        *attrib = (*attrib & 0x8F) | (vga_color[param - 40] << 4);
+    else if (param == 49)
+        *attrib = *attrib & 0x8F;
+}
 
-            case 2:
-                map_4KB_page((uint32_t)VID_B2);
-                break;
+/* void ansi_erase(uint8_t term_num, uint32_t from, uint32_t to);
+ * Inputs: term_num -- terminal
+ *         from, to -- first and one past the last cell of the window to blank
+ * Return Value: None
+ * Function: Blank a range of cells in the terminal's current colors */
+static void ansi_erase(uint8_t term_num, uint32_t from, uint32_t to) {
+    if (to > from)
+        memset_word(term_cells(term_num) + from, blank_cell(term_num), to - from);
+}
 
-            default:
-                break;
-        }
+/* void ansi_csi(uint8_t term_num, uint8_t final);
+ * Inputs: term_num -- terminal
+ *         final -- last character of an ESC [ ... sequence
+ * Return Value: None
+ * Function: Run a complete control sequence. Supported are cursor moves
+ *           (A B C D H f), erasing the screen (J) or line (K), colors (m)
+ *           and saving and restoring the cursor (s u). */
+static void ansi_csi(uint8_t term_num, uint8_t final) {
+    ansi_t* a = &ansi[term_num];
+    terminal_t* term = &terminal[term_num];
+    uint32_t n = a->params[0] ? a->params[0] : 1;   // count, default 1
+    uint32_t pos = term->screen_y * NUM_COLS + term->screen_x;
+    uint32_t i;
+
+    switch (final) {
+        case 'A':
+            term->screen_y = term->screen_y > n ? term->screen_y - n : 0;
+            break;
+        case 'B':
+            term->screen_y = term->screen_y + n < NUM_ROWS ? term->screen_y + n : NUM_ROWS - ONE_LINE;
+            break;
+        case 'C':
+            term->screen_x = term->screen_x + n < NUM_COLS ? term->screen_x + n : NUM_COLS - ONE_LINE;
+            break;
+        case 'D':
+            term->screen_x = term->screen_x > n ? term->screen_x - n : 0;
+            break;
+        case 'H':
+        case 'f':
+            // rows and columns count from 1
+            term->screen_y = n <= NUM_ROWS ? n - 1 : NUM_ROWS - ONE_LINE;
+            n = (a->nparams > 1 && a->params[1]) ? a->params[1] : 1;
+            term->screen_x = n <= NUM_COLS ? n - 1 : NUM_COLS - ONE_LINE;
+            break;
+        case 'J':
+            if (a->params[0] == 0)
+                ansi_erase(term_num, pos, NUM_ROWS * NUM_COLS);
+            else if (a->params[0] == 1)
+                ansi_erase(term_num, 0, pos + 1);
+            else
+                ansi_erase(term_num, 0, NUM_ROWS * NUM_COLS);
+            break;
+        case 'K':
+            if (a->params[0] == 0)
+                ansi_erase(term_num, pos, pos - term->screen_x + NUM_COLS);
+            else if (a->params[0] == 1)
+                ansi_erase(term_num, pos - term->screen_x, pos + 1);
+            else
+                ansi_erase(term_num, pos - term->screen_x, pos - term->screen_x + NUM_COLS);
+            break;
+        case 'm':
+            for (i = 0; i < a->nparams; i++)
+                ansi_sgr(term_num, a->params[i]);
+            break;
+        case 's':
+            a->saved_x = term->screen_x;
+            a->saved_y = term->screen_y;
+            break;
+        case 'u':
+            term->screen_x = a->saved_x;
+            term->screen_y = a->saved_y;
+            break;
+        default:
+            break;
     }
-    // save previous end character position
-    if(auto_flag[term_num] == 1 && terminal[term_num].screen_x == X_START){   // if auto entering next line was implemented and at the first position of the new line
-      // auto entered and new enter pressed at beginning of line
-      set_text_pos(X_START, terminal[term_num].screen_y, term_num);
-      auto_flag[term_num] = 0;   // set auto flag back to 0 after handling
+    // the cursor was placed explicitly, a pending wrap no longer applies
+    auto_flag[term_num] = 0;
+}
+
+/* void ansi_char(uint8_t term_num, uint8_t c);
+ * Inputs: term_num -- terminal
+ *         c -- ESC or the next character of an escape sequence
+ * Return Value: None
+ * Function: Feed one character to the escape sequence state machine. The
+ *           state is kept per terminal, so a sequence may be split across
+ *           writes. */
+static void ansi_char(uint8_t term_num, uint8_t c) {
+    ansi_t* a = &ansi[term_num];
+    terminal_t* term = &terminal[term_num];
+
+    switch (a->state) {
+        case ESC_NORMAL:
+            a->state = ESC_ESCAPE;
+            return;
+
+        case ESC_ESCAPE:
+            a->state = ESC_NORMAL;
+            if (c == '[') {
+                a->state = ESC_CSI;
+                a->nparams = 1;
+                a->params[0] = 0;
+            }
+            else if (c == '7') {
+                a->saved_x = term->screen_x;
+                a->saved_y = term->screen_y;
+            }
+            else if (c == '8') {
+                term->screen_x = a->saved_x;
+                term->screen_y = a->saved_y;
+                auto_flag[term_num] = 0;
+            }
+            return;
+
+        default:
+            if (c >= '0' && c <= '9') {
+                uint16_t* p = &a->params[a->nparams - 1];
+                *p = *p * 10 + (c - '0');
+                if (*p > ESC_MAX_VALUE)
+                    *p = ESC_MAX_VALUE;
+            }
+            else if (c == ';') {
+                // extra numbers are parsed into the last slot and ignored
+                if (a->nparams < ESC_MAX_PARAMS)
+                    a->nparams++;
+                a->params[a->nparams - 1] = 0;
+            }
+            else if (c >= '@' && c <= '~') {
+                ansi_csi(term_num, c);
+                a->state = ESC_NORMAL;
+            }
+            else if (c < ' ' || c > '?') {
+                // not part of a control sequence, drop it
+                a->state = ESC_NORMAL;
+            }
+            return;
     }
-    else{
-      // save previous line position
-      prev_x[terminal[term_num].screen_y] = terminal[term_num].screen_x;
-      set_text_pos(X_START, terminal[term_num].screen_y + ONE_LINE, term_num);
+}
 
+/* void putbuf(const uint8_t* buf, int32_t nbytes, uint8_t term_num);
+ * Inputs: buf -- characters to print
+ *         nbytes -- number of characters in buf
+ *         term_num -- terminal to print to
+ * Return Value: None
+ * Function: Print a whole buffer with the same wrapping and scrolling as
+ *           putkey, but store runs of characters
+ *           straight into the text buffer and move the cursor only at the
+ *           end. Escape sequences are interpreted, see ansi_csi. The
+ *           caller holds console_lock. */
+void putbuf(const uint8_t* buf, int32_t nbytes, uint8_t term_num) {
+    terminal_t* term = &terminal[term_num];
+    uint16_t* cell;
+    uint16_t attrib;
+    int32_t i = 0, run;
+
+    end_view(term_num);
+    while (i < nbytes) {
+      if (ansi[term_num].state != ESC_NORMAL || buf[i] == ESC) {
+        ansi_char(term_num, buf[i]);
+        i++;
+        continue;
+      }
+      if (buf[i] == '\n') {
+        newline(term_num);
+        i++;
+        continue;
+      }
+      if (buf[i] == '\r') {
+        term->screen_x = X_START;
+        auto_flag[term_num] = 0;
+        i++;
+        continue;
+      }
+      // the run ends at a control character or at the end of the row
+      cell = term_cells(term_num) + NUM_COLS * term->screen_y + term->screen_x;
+      attrib = ansi[term_num].attrib << 8;
+      run = 0;
+      while (i < nbytes && buf[i] != '\n' && buf[i] != '\r' && buf[i] != ESC &&
+             term->screen_x + run < NUM_COLS) {
+        cell[run++] = attrib | buf[i];
+        i++;
+      }
+      term->screen_x += run;
+      if (term->screen_x >= NUM_COLS) {
+        // wrap exactly like set_text_pos does for putkey
+        term->screen_x = NUM_COLS - ONE_LINE;
+        auto_flag[term_num] = 1;
+        newline(term_num);
+      }
+    }
+    if(term_num == screen_terminal){
+      update_cursor();
     }
 }
 
@@ -391,12 +754,37 @@ void set_text_pos(int x, int y, uint8_t term_num) {
 }
 
 
+/* void reset_origin(uint8_t term_num);
+ * Inputs: term_num -- terminal to reset
+ * Return Value: None
+ * Function: Move a terminal's text back to the start of its region, where
+ *           vidmap programs expect it. The caller holds console_lock. */
+void reset_origin(uint8_t term_num) {
+    uint16_t* region = term_region(term_num);
+    end_view(term_num);
+    if (origin[term_num] == 0)
+        return;
+    memmove(region, region + origin[term_num], NUM_ROWS * NUM_COLS * 2);
+    set_origin(term_num, 0);
+    if (term_num == screen_terminal)
+        update_cursor();
+}
+
+
 /* void update_cursor();
  * Inputs: None
  * Return Value: None
  * Function: Update cursor to current screen x, y positions */
 void update_cursor() {
-      uint16_t pos = terminal[screen_terminal].screen_y * NUM_COLS + terminal[screen_terminal].screen_x;
+      // the cursor position counts from the start of video memory, not the window
+      uint16_t pos = screen_terminal * REGION_CELLS + origin[screen_terminal] +
+                     terminal[screen_terminal].screen_y * NUM_COLS + terminal[screen_terminal].screen_x;
+      if (fb_enabled) {
+          // the cursor is hidden while the scrollback view is shown
+          fb_draw_text(screen_terminal, (uint16_t*)text_mem + shown_start,
+                       pos >= shown_start && pos < shown_start + NUM_ROWS * NUM_COLS ? (int32_t)(pos - shown_start) : -1);
+          return;
+      }
       // cursor low port to VGA index register
       outb(0x0F, 0x3D4);
       // cursor low position to VGA data register
@@ -411,21 +799,39 @@ void update_cursor() {
 /* void scroll();
  * Inputs: None
  * Return Value: None
- * Function: Enable vertical scrolling to the next line*/
+ * Function: Enable vertical scrolling to the next line. The caller holds
+ *           console_lock and moves the text position. A terminal scrolls by
+ *           moving its window down a row, so only the new row is written;
+ *           once the window reaches the end of the terminal's region the
+ *           rows are copied back to its start. */
 void scroll(uint8_t term_num) {
-  cli();
-    uint32_t i, j;
-    // iterate through every screen position to copy from next line to current line, discarding the first line
-    for (i = 0; i < NUM_ROWS - ONE_LINE; i++) {
-        for (j = 0; j < NUM_COLS; j++) {
-            *(uint8_t *)(video_mem + ((NUM_COLS * (i) + j) << CONST_OFFSET)) = *(uint8_t *)(video_mem + ((NUM_COLS * (i+ONE_LINE) + j) << CONST_OFFSET));
-        }
+    uint16_t* region = term_region(term_num);
+    uint16_t* top = term_cells(term_num);
+    uint8_t* line = history[term_num][history_head[term_num]];
+    uint32_t i;
+    // keep the characters of the row about to go off the top
+    for (i = 0; i < NUM_COLS; i++)
+        line[i] = (uint8_t)top[i];
+    history_head[term_num] = (history_head[term_num] + 1) % SCROLLBACK_LINES;
+    if (history_count[term_num] < SCROLLBACK_LINES)
+        history_count[term_num]++;
+
+    // vidmap programs draw at the start of the region, so their text stays put
+    if (terminal[term_num].fish_check != 0) {
+        memmove(top, top + NUM_COLS, (NUM_ROWS - ONE_LINE) * NUM_COLS * 2);
+        memset_word(top + (NUM_ROWS - ONE_LINE) * NUM_COLS, blank_cell(term_num), NUM_COLS);
+        return;
+    }
+    if (origin[term_num] + (NUM_ROWS + ONE_LINE) * NUM_COLS > REGION_CELLS) {
+        memmove(region, top + NUM_COLS, (NUM_ROWS - ONE_LINE) * NUM_COLS * 2);
+        memset_word(region + (NUM_ROWS - ONE_LINE) * NUM_COLS, blank_cell(term_num), NUM_COLS);
+        set_origin(term_num, 0);
     }
-    // set the next entire line to ' ' for each column position
-    for (i = 0; i < NUM_COLS; i++) {
-        *(uint8_t *)(video_mem + ((NUM_COLS * (NUM_ROWS - ONE_LINE) + i) << CONST_OFFSET)) = ' ';
+    else {
+        // blank the row coming into view before showing it
+        memset_word(top + NUM_ROWS * NUM_COLS, blank_cell(term_num), NUM_COLS);
+        set_origin(term_num, origin[term_num] + NUM_COLS);
     }
-    set_text_pos(X_START, terminal[term_num].screen_y, term_num);
 }
 
 
@@ -638,12 +1044,21 @@ void* memmove(void* dest, const void* src, uint32_t n) {
             movw    %%dx, %%es                  \n\
             cld                                 \n\
             cmp     %%edi, %%esi                \n\
-            jae     .memmove_go                 \n\
+            jae     .memmove_fwd                \n\
             leal    -1(%%esi, %%ecx), %%esi     \n\
             leal    -1(%%edi, %%ecx), %%edi     \n\
             std                                 \n\
-            .memmove_go:                        \n\
             rep     movsb                       \n\
+            cld                                 \n\
+            jmp     .memmove_done               \n\
+            .memmove_fwd:                       \n\
+            movl    %%ecx, %%edx                \n\
+            shrl    $2, %%ecx                   \n\
+            andl    $0x3, %%edx                 \n\
+            rep     movsl                       \n\
+            movl    %%edx, %%ecx                \n\
+            rep     movsb                       \n\
+            .memmove_done:                      \n\
             "
             :
             : "D"(dest), "S"(src), "c"(n)
@@ -719,6 +1134,7 @@ int8_t* strncpy(int8_t* dest, const int8_t* src, uint32_t n) {
  * Function: increments video memory. To be used to test rtc */
 void test_interrupts(void) {
     int32_t i;
+    char* video_mem = (char*)term_cells(screen_terminal);
     for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
         video_mem[i << 1]++;
     }
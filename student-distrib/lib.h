@@ -28,8 +28,20 @@ void putkey(uint8_t c, uint8_t term_num);
 void remove_char(int buffer_index);
 /* function to update the cursor */
 void update_cursor();
+/* function to move a scrolled terminal back to the start of its video memory */
+void reset_origin(uint8_t term_num);
+/* function to find the text memory a terminal owns */
+uint32_t term_video_addr(uint8_t term_num);
+/* function to keep the text in RAM once the framebuffer console is used */
+void console_use_ram();
+/* function to redraw the framebuffer after vidmap programs wrote text */
+void console_sync();
 /* function to handle enter */
 void enter_lib(uint8_t term_num);
+/* function to put a whole buffer to the screen */
+void putbuf(const uint8_t* buf, int32_t nbytes, uint8_t term_num);
+/* function to view the lines scrolled off the screen terminal */
+void scrollback(int32_t lines);
 /* function to enable vertical scrolling */
 void scroll(uint8_t term_num);
 /* function to set current text position */
@@ -121,7 +133,7 @@ do {                                    \
 /* Writes four bytes to four consecutive ports */
 #define outl(data, port)                \
 do {                                    \
-    asm volatile ("outl %l1, (%w0)"     \
+    asm volatile ("outl %k1, (%w0)"     \
             :                           \
             : "d"(port), "a"(data)      \
             : "memory", "cc"            \
@@ -0,0 +1,56 @@
+#ifndef _LOCK_H
+#define _LOCK_H
+
+#include "types.h"
+#include "lib.h"
+
+#ifndef ASM
+
+/* spinlock, only ever taken with interrupts off on the local cpu */
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPIN_LOCK_UNLOCKED  { 0 }
+
+/* Acquire a spinlock. Callers must already have interrupts off, use
+ * spin_lock_irqsave otherwise */
+static inline void spin_lock(spinlock_t* lock) {
+    uint32_t old;
+    while (1) {
+        old = 1;
+        asm volatile ("xchgl %0, %1"
+                : "+r"(old), "+m"(lock->locked)
+                :
+                : "memory"
+        );
+        if (old == 0)
+            return;
+        // spin on a plain read so the cache line is not bounced around
+        while (lock->locked)
+            asm volatile ("pause");
+    }
+}
+
+/* Release a spinlock */
+static inline void spin_unlock(spinlock_t* lock) {
+    asm volatile ("" : : : "memory");
+    lock->locked = 0;
+}
+
+/* Disable interrupts, saving EFLAGS in "flags", and acquire the lock */
+#define spin_lock_irqsave(lock, flags)      \
+do {                                        \
+    cli_and_save(flags);                    \
+    spin_lock(lock);                        \
+} while (0)
+
+/* Release the lock and restore the interrupt flag saved in "flags" */
+#define spin_unlock_irqrestore(lock, flags) \
+do {                                        \
+    spin_unlock(lock);                      \
+    restore_flags(flags);                   \
+} while (0)
+
+#endif /* ASM */
+#endif /* _LOCK_H */
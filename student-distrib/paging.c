@@ -1,17 +1,17 @@
 #include "paging.h"
 #include "system_calls.h"
 #include "terminal.h"
+#include "lib.h"
+#include "lock.h"
 
 
 #define VIDEO_MEM             0xB8000
-#define VID_MEM_INDEX         0xB8
 #define PAGE_DIR_SIZE         1024
 #define NUM_BYTES_TOTAL       4096
 #define SET_PRESENT_RW        0x3
 #define BIT_MASK_UPPER_20     0xFFFFFC00
 #define SET_OFFSET_BITS       0x187
 #define KERNEL_ADDRESS        0x400000
-#define USER_PD_IDX           32
 #define _8MB                  0x800000
 #define _4MB                  0x400000
 #define _8KB                  0x2000
@@ -24,9 +24,16 @@
 #define PD_SHIFT              22 // right shift 22 bits to obtain page directory bits
 #define PT_SHIFT              12 // right shift 12 bits to obtain page table bits
 #define PT_MASK               0x3FF // mask to obtain page table bits
-#define VID_B0                0xB9000
-#define VID_B1                0xBA000
-#define VID_B2                0xBB000
+#define VIDEO_END             0xC0000 // end of VGA text memory
+#define FRAME_POOL_START      0x800000 // 8 MB, right above the kernel
+#define FRAME_POOL_PD_IDX     2     // first PDE of the frame pool
+#define FRAME_POOL_PDES       8     // frame pool spans 8 * 4MB = 32 MB
+#define FRAME_POOL_FRAMES     (FRAME_POOL_PDES * PAGE_DIR_SIZE)
+#define SET_POOL_BITS         0x83  // Present, R/W, 4MB, supervisor only
+#define PAGE_PRESENT          0x1
+#define ZERO_POOL_SIZE        64    // pre-zeroed frames kept ready by the idle loop
+#define CPUID_SSE2            0x04000000 // CPUID.01H:EDX bit 26
+#define SET_MMIO_BITS         0x9B  // Present, R/W, write-through, cache disable, 4MB
 
 
 
@@ -36,6 +43,79 @@ uint32_t page_directory[PAGE_DIR_SIZE] __attribute__((aligned(NUM_BYTES_TOTAL)))
 uint32_t page_table[PAGE_DIR_SIZE] __attribute__((aligned(NUM_BYTES_TOTAL)));
 uint32_t vid_page_table[PAGE_DIR_SIZE] __attribute__((aligned(NUM_BYTES_TOTAL)));
 
+// stack of free frame numbers in the frame pool
+static uint16_t free_frames[FRAME_POOL_FRAMES];
+static uint32_t free_frame_count;
+// stack of frames already cleared by the idle loop
+static uint32_t zeroed_frames[ZERO_POOL_SIZE];
+static uint32_t zeroed_frame_count;
+// protects free_frames and zeroed_frames
+static spinlock_t frame_lock = SPIN_LOCK_UNLOCKED;
+// set if the CPU supports movnti
+static int32_t sse2_present;
+
+/* cpu_has_sse2()
+ *
+ * Description: check CPUID for SSE2, which provides the movnti instruction
+ * Inputs: None
+ * Outputs: None
+ * Return Value: 1 if SSE2 is available, 0 otherwise
+ */
+static int32_t cpu_has_sse2() {
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile ("cpuid"
+        : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+    );
+    return (edx & CPUID_SSE2) != 0;
+}
+
+/* zero_frame(uint32_t frame)
+ *
+ * Description: clear a 4KB frame. With SSE2 the stores are non-temporal, so
+ *              the idle loop does not evict the working set of the next task.
+ * Inputs: frame -- identity mapped physical address of the frame
+ * Outputs: None
+ * Side Effects: None
+ */
+static void zero_frame(uint32_t frame) {
+    uint32_t count = _4KB / 32;     // 32 bytes per iteration
+    if (!sse2_present) {
+        memset_dword((void*)frame, 0, _4KB / 4);
+        return;
+    }
+    asm volatile ("                 \n\
+            xorl    %%eax, %%eax    \n\
+            1:                      \n\
+            movnti  %%eax, (%0)     \n\
+            movnti  %%eax, 4(%0)    \n\
+            movnti  %%eax, 8(%0)    \n\
+            movnti  %%eax, 12(%0)   \n\
+            movnti  %%eax, 16(%0)   \n\
+            movnti  %%eax, 20(%0)   \n\
+            movnti  %%eax, 24(%0)   \n\
+            movnti  %%eax, 28(%0)   \n\
+            addl    $32, %0         \n\
+            decl    %1              \n\
+            jnz     1b              \n\
+            sfence                  \n\
+            "
+            : "+r"(frame), "+r"(count)
+            :
+            : "eax", "memory", "cc"
+    );
+}
+
+/* invlpg(uint32_t addr)
+ *
+ * Description: flush the TLB entry of a single virtual page
+ * Inputs: addr -- virtual address inside the page
+ * Outputs: None
+ * Side Effects: None
+ */
+static inline void invlpg(uint32_t addr) {
+    asm volatile ("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
 /* page_init()
  *
  * Description: initialize paging by setting up page directory and page table
@@ -61,9 +141,26 @@ void page_init()  {
     // set up second pde for kernel
     page_directory[1] = (KERNEL_ADDRESS) + SET_OFFSET_BITS;
 
-    // set page base address, Present in PTE
-    page_table[VID_MEM_INDEX] = (VIDEO_MEM) + SET_PRESENT_RW;
+    // set page base address, Present in PTE; every terminal draws into its
+    // own region of text memory, so all of it stays mapped
+    for (i = VIDEO_MEM; i < VIDEO_END; i += _4KB) {
+        page_table[i >> PT_SHIFT] = i + SET_PRESENT_RW;
+    }
+
+    // identity map the frame pool so the kernel can fill and zero frames
+    for (i = 0; i < FRAME_POOL_PDES; i++) {
+        page_directory[FRAME_POOL_PD_IDX + i] = (FRAME_POOL_START + i * _4MB) | SET_POOL_BITS;
+    }
+
+    // push frames in reverse so low addresses are handed out first
+    zeroed_frame_count = 0;
+    free_frame_count = 0;
+    for (i = FRAME_POOL_FRAMES - 1; i >= 0; i--) {
+        free_frames[free_frame_count++] = i;
+    }
+
 
+    sse2_present = cpu_has_sse2();
 
     // Enable paging
     asm volatile (
@@ -88,16 +185,28 @@ void page_init()  {
 }
 
 
-/* map_4MB_page(uint32_t pid)
+/* map_process_pages(uint32_t pid)
  *
- * Description: map virtual address to physical address
- * Inputs: None
+ * Description: map virtual address to physical address by installing the
+ *              page tables backing the image, stack, heap and mmap areas
+ *              of process pid
+ * Inputs: pid -- process whose user memory should become visible
  * Outputs: None
  * Side Effects: None
  */
-void map_4MB_page(uint32_t pid){
-  // map virtual address to physical memory address
-  page_directory[USER_PD_IDX] = (_8MB + (_4MB * pid)) | SET_PRESENT_RW | US_FLAG | PAGE_SIZE_4MB;
+void map_process_pages(uint32_t pid){
+  int i;
+  pcb_t* pcb = (pcb_t*) (_8MB - (pid + 1) * _8KB);
+
+  for (i = USER_PT_FIRST_SLOT; i < USER_PT_COUNT; i++) {
+    // vidmap keeps its own shared page table
+    if (i == VIDMAP_PT_SLOT)
+      continue;
+    if (pcb->user_pt[i] != 0)
+      page_directory[USER_PD_IDX + i] = pcb->user_pt[i] | SET_PRESENT_RW | US_FLAG;
+    else
+      page_directory[USER_PD_IDX + i] = 0;
+  }
 
   // flush TLB
   asm volatile (
@@ -133,33 +242,12 @@ void map_video_mem(uint32_t virtual_addr){
       :"%eax"
     );
 
-  if (id == screen_terminal) {
+  if (id < TERMINAL_COUNT) {
     // mapping page directory entry to video page table and set user level priviledge
     page_directory[virtual_addr >> PD_SHIFT] = ((uint32_t)vid_page_table & BIT_MASK_UPPER_20) | SET_PRESENT_RW | US_FLAG;
-    // map video page table entry to directly point to video memory and set user level priviledge
-    vid_page_table[(virtual_addr >> PT_SHIFT) & PT_MASK ] =  (VIDEO_MEM) | SET_PRESENT_RW | US_FLAG;
-  }
-  else{
-    // check terminal id to determine appropriate page directory and video page table mapping
-    switch(id){
-      case 0:
-        page_directory[virtual_addr >> PD_SHIFT] = ((uint32_t)vid_page_table & BIT_MASK_UPPER_20) | SET_PRESENT_RW | US_FLAG;
-        vid_page_table[(virtual_addr >> PT_SHIFT) & PT_MASK ] =  (VID_B0) | SET_PRESENT_RW | US_FLAG;
-        break;
-
-      case 1:
-        page_directory[virtual_addr >> PD_SHIFT] = ((uint32_t)vid_page_table & BIT_MASK_UPPER_20) | SET_PRESENT_RW | US_FLAG;
-        vid_page_table[(virtual_addr >> PT_SHIFT) & PT_MASK ] =  (VID_B1) | SET_PRESENT_RW | US_FLAG;
-        break;
-
-      case 2:
-        page_directory[virtual_addr >> PD_SHIFT] = ((uint32_t)vid_page_table & BIT_MASK_UPPER_20) | SET_PRESENT_RW | US_FLAG;
-        vid_page_table[(virtual_addr >> PT_SHIFT) & PT_MASK ] =  (VID_B2) | SET_PRESENT_RW | US_FLAG;
-        break;
-
-      default:
-        break;
-    }
+    // point the page at the start of the terminal's own text memory, which
+    // stays the same whether or not the terminal is shown
+    vid_page_table[(virtual_addr >> PT_SHIFT) & PT_MASK ] =  term_video_addr(id) | SET_PRESENT_RW | US_FLAG;
   }
 
   asm volatile (
@@ -176,42 +264,304 @@ void map_video_mem(uint32_t virtual_addr){
     );
 }
 
-/* map_video_page(uint32_t addr)
+/* map_low_range(uint32_t start, uint32_t end)
+ *
+ * Description: identity map the 4KB pages of the first 4MB in [start, end)
+ *              as supervisor pages, e.g. to read BIOS tables. Pages that are
+ *              already mapped (video memory) are left alone.
+ * Inputs: start, end -- page aligned physical range below 4MB
+ * Outputs: None
+ * Side Effects: flushes the TLB
+ */
+void map_low_range(uint32_t start, uint32_t end) {
+    uint32_t addr;
+    for (addr = start; addr < end; addr += _4KB) {
+        if (!(page_table[addr >> PT_SHIFT] & PAGE_PRESENT))
+            page_table[addr >> PT_SHIFT] = addr | SET_PRESENT_RW;
+    }
+    asm volatile (
+        "movl %%cr3, %%eax;"
+        "movl %%eax, %%cr3;"
+        :
+        :
+        :"%eax"
+      );
+}
+
+/* unmap_low_range(uint32_t start, uint32_t end)
+ *
+ * Description: remove pages mapped by map_low_range, video memory pages in
+ *              the range stay mapped
+ * Inputs: start, end -- page aligned physical range below 4MB
+ * Outputs: None
+ * Side Effects: flushes the TLB
+ */
+void unmap_low_range(uint32_t start, uint32_t end) {
+    uint32_t addr;
+    for (addr = start; addr < end; addr += _4KB) {
+        if (page_table[addr >> PT_SHIFT] == (addr | SET_PRESENT_RW) &&
+            (addr < VIDEO_MEM || addr >= VIDEO_END))
+            page_table[addr >> PT_SHIFT] = 0;
+    }
+    asm volatile (
+        "movl %%cr3, %%eax;"
+        "movl %%eax, %%cr3;"
+        :
+        :
+        :"%eax"
+      );
+}
+
+/* map_mmio_4MB(uint32_t physical)
+ *
+ * Description: identity map the 4MB region holding physical as an uncached
+ *              supervisor page, for device memory such as the framebuffer
+ * Inputs: physical -- address inside the region
+ * Outputs: None
+ * Side Effects: flushes the TLB
+ */
+void map_mmio_4MB(uint32_t physical) {
+    page_directory[physical >> PD_SHIFT] = (physical & ~(_4MB - 1)) | SET_MMIO_BITS;
+    asm volatile (
+        "movl %%cr3, %%eax;"
+        "movl %%eax, %%cr3;"
+        :
+        :
+        :"%eax"
+      );
+}
+
+
+/* alloc_frame()
+ *
+ * Description: take a 4KB physical frame from the frame pool, falling
+ *              back to the pre-zeroed frames once the pool runs dry
+ * Inputs: None
+ * Outputs: None
+ * Return Value: physical address of the frame, 0 if the pool is empty
+ */
+uint32_t alloc_frame() {
+    uint32_t flags, frame = 0;
+    spin_lock_irqsave(&frame_lock, flags);
+    if (free_frame_count != 0) {
+        free_frame_count--;
+        frame = FRAME_POOL_START + ((uint32_t)free_frames[free_frame_count] << PT_SHIFT);
+    }
+    else if (zeroed_frame_count != 0) {
+        frame = zeroed_frames[--zeroed_frame_count];
+    }
+    spin_unlock_irqrestore(&frame_lock, flags);
+    return frame;
+}
+
+/* alloc_zeroed_frame()
  *
- * Description: remap virtual address to physical address for video memory
- * Inputs: 32-bit address
+ * Description: take a cleared 4KB frame, preferring one zeroed ahead of time
+ *              by the idle loop so execute and page faults skip the clear
+ * Inputs: None
+ * Outputs: None
+ * Return Value: physical address of the frame, 0 if the pool is empty
+ */
+uint32_t alloc_zeroed_frame() {
+    uint32_t flags, frame = 0;
+    spin_lock_irqsave(&frame_lock, flags);
+    if (zeroed_frame_count != 0)
+        frame = zeroed_frames[--zeroed_frame_count];
+    spin_unlock_irqrestore(&frame_lock, flags);
+    if (frame != 0)
+        return frame;
+
+    frame = alloc_frame();
+    if (frame != 0)
+        zero_frame(frame);
+    return frame;
+}
+
+/* refill_zero_pool()
+ *
+ * Description: zero free frames until ZERO_POOL_SIZE are ready. Called from
+ *              the idle loop; interrupts are only held off for one frame.
+ * Inputs: None
  * Outputs: None
  * Side Effects: None
  */
-void map_video_page(uint32_t addr){
-  // set page base address, Present in PTE
-  page_table[(addr >> PT_SHIFT)] = addr + SET_PRESENT_RW;
+void refill_zero_pool() {
+    uint32_t flags, frame;
+    while (1) {
+        spin_lock_irqsave(&frame_lock, flags);
+        if (zeroed_frame_count >= ZERO_POOL_SIZE || free_frame_count == 0) {
+            spin_unlock_irqrestore(&frame_lock, flags);
+            return;
+        }
+        free_frame_count--;
+        frame = FRAME_POOL_START + ((uint32_t)free_frames[free_frame_count] << PT_SHIFT);
+        zero_frame(frame);
+        zeroed_frames[zeroed_frame_count++] = frame;
+        spin_unlock_irqrestore(&frame_lock, flags);
+    }
+}
 
-  // flush TLB
-  asm volatile (
-      // load CR3 with address of the page directory
-      "movl %%cr3, %%eax;"
-      "movl %%eax, %%cr3;"
-      :
-      :
-      :"%eax"
-    );
+/* free_frame(uint32_t frame)
+ *
+ * Description: give a 4KB physical frame back to the frame pool
+ * Inputs: frame -- physical address returned by alloc_frame
+ * Outputs: None
+ * Side Effects: None
+ */
+void free_frame(uint32_t frame) {
+    uint32_t flags;
+    if (frame < FRAME_POOL_START || frame >= FRAME_POOL_START + FRAME_POOL_FRAMES * _4KB)
+        return;
+    spin_lock_irqsave(&frame_lock, flags);
+    free_frames[free_frame_count++] = (frame - FRAME_POOL_START) >> PT_SHIFT;
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+/* init_user_pages(pcb_t* pcb)
+ *
+ * Description: start a new process with no page tables, an empty heap
+ *              and no anonymous mappings
+ * Inputs: pcb -- pcb of the new process
+ * Outputs: None
+ * Side Effects: None
+ */
+void init_user_pages(pcb_t* pcb) {
+    int i;
+    for (i = 0; i < USER_PT_COUNT; i++)
+        pcb->user_pt[i] = 0;
+    pcb->heap_brk = HEAP_START_ADDR;
+    for (i = 0; i < MAX_MMAP_AREAS; i++) {
+        pcb->mmap_area[i].start = 0;
+        pcb->mmap_area[i].end = 0;
+    }
+    for (i = 0; i < MAX_SHM_ATTACH; i++) {
+        pcb->shm_attach[i].id = -1;
+        pcb->shm_attach[i].start = 0;
+        pcb->shm_attach[i].end = 0;
+    }
 }
 
+/* map_user_page(pcb_t* pcb, uint32_t virtual_addr, uint32_t frame)
+ *
+ * Description: map one 4KB user page, allocating the page table on first use.
+ *              pcb must be the process whose page tables are loaded.
+ * Inputs: pcb -- owner of the mapping
+ *         virtual_addr -- page aligned user address
+ *         frame -- physical frame to map
+ * Outputs: None
+ * Return Value: 0 on success, -1 if out of range or out of memory
+ */
+int32_t map_user_page(pcb_t* pcb, uint32_t virtual_addr, uint32_t frame) {
+    uint32_t slot = (virtual_addr >> PD_SHIFT) - USER_PD_IDX;
+    uint32_t* table;
+    if (slot < USER_PT_FIRST_SLOT || slot >= USER_PT_COUNT || slot == VIDMAP_PT_SLOT)
+        return -1;
+
+    if (pcb->user_pt[slot] == 0) {
+        pcb->user_pt[slot] = alloc_zeroed_frame();
+        if (pcb->user_pt[slot] == 0)
+            return -1;
+        page_directory[USER_PD_IDX + slot] = pcb->user_pt[slot] | SET_PRESENT_RW | US_FLAG;
+    }
+    table = (uint32_t*)pcb->user_pt[slot];
+    table[(virtual_addr >> PT_SHIFT) & PT_MASK] = frame | SET_PRESENT_RW | US_FLAG;
+    invlpg(virtual_addr);
+    return 0;
+}
 
-/* map_4KB_page(uint32_t physical)
+/* map_user_range(pcb_t* pcb, uint32_t start, uint32_t end)
  *
- * Description: map page table entry to a given physical address
- * Inputs: 32-bit physical address
+ * Description: back every user page overlapping [start, end) with a zeroed frame
+ * Inputs: pcb -- owner of the pages, must be the current process
+ *         start, end -- user address range
+ * Outputs: None
+ * Return Value: 0 on success, -1 if out of memory
+ */
+int32_t map_user_range(pcb_t* pcb, uint32_t start, uint32_t end) {
+    uint32_t addr, frame;
+    for (addr = PAGE_ALIGN_DOWN(start); addr < end; addr += _4KB) {
+        frame = alloc_zeroed_frame();
+        if (frame == 0)
+            return -1;
+        if (map_user_page(pcb, addr, frame) == -1) {
+            free_frame(frame);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* unmap_user_range(pcb_t* pcb, uint32_t start, uint32_t end)
+ *
+ * Description: unmap the user pages in [start, end) and free their frames
+ * Inputs: pcb -- owner of the pages
+ *         start, end -- page aligned bounds
  * Outputs: None
  * Side Effects: None
  */
-void map_4KB_page(uint32_t physical) {
-    page_table[VID_MEM_INDEX] = physical + SET_PRESENT_RW;
+void unmap_user_range(pcb_t* pcb, uint32_t start, uint32_t end) {
+    uint32_t addr, slot;
+    uint32_t* table;
+    for (addr = start; addr < end; addr += _4KB) {
+        slot = (addr >> PD_SHIFT) - USER_PD_IDX;
+        if (slot >= USER_PT_COUNT || pcb->user_pt[slot] == 0)
+            continue;
+        table = (uint32_t*)pcb->user_pt[slot];
+        if (table[(addr >> PT_SHIFT) & PT_MASK] & PAGE_PRESENT) {
+            free_frame(table[(addr >> PT_SHIFT) & PT_MASK] & BIT_MASK_UPPER_20);
+            table[(addr >> PT_SHIFT) & PT_MASK] = 0;
+            invlpg(addr);
+        }
+    }
+}
+
+/* detach_user_range(pcb_t* pcb, uint32_t start, uint32_t end)
+ *
+ * Description: unmap the user pages in [start, end) but keep their frames,
+ *              which belong to a shared memory segment
+ * Inputs: pcb -- owner of the mapping
+ *         start, end -- page aligned bounds
+ * Outputs: None
+ * Side Effects: None
+ */
+void detach_user_range(pcb_t* pcb, uint32_t start, uint32_t end) {
+    uint32_t addr, slot;
+    uint32_t* table;
+    for (addr = start; addr < end; addr += _4KB) {
+        slot = (addr >> PD_SHIFT) - USER_PD_IDX;
+        if (slot >= USER_PT_COUNT || pcb->user_pt[slot] == 0)
+            continue;
+        table = (uint32_t*)pcb->user_pt[slot];
+        table[(addr >> PT_SHIFT) & PT_MASK] = 0;
+        invlpg(addr);
+    }
+}
+
+/* free_user_pages(pcb_t* pcb)
+ *
+ * Description: free every page and page table owned by a halting process
+ * Inputs: pcb -- pcb of the current process
+ * Outputs: None
+ * Side Effects: flushes the TLB
+ */
+void free_user_pages(pcb_t* pcb) {
+    int i, j;
+    uint32_t* table;
+    for (i = USER_PT_FIRST_SLOT; i < USER_PT_COUNT; i++) {
+        if (pcb->user_pt[i] == 0 || i == VIDMAP_PT_SLOT)
+            continue;
+        table = (uint32_t*)pcb->user_pt[i];
+        for (j = 0; j < PAGE_DIR_SIZE; j++) {
+            if (table[j] & PAGE_PRESENT)
+                free_frame(table[j] & BIT_MASK_UPPER_20);
+        }
+        free_frame(pcb->user_pt[i]);
+        pcb->user_pt[i] = 0;
+        page_directory[USER_PD_IDX + i] = 0;
+    }
 
     // flush TLB
     asm volatile (
-        // load CR3 with address of the page directory
         "movl %%cr3, %%eax;"
         "movl %%eax, %%cr3;"
         :
@@ -219,3 +569,42 @@ void map_4KB_page(uint32_t physical) {
         :"%eax"
       );
 }
+
+/* handle_demand_fault(uint32_t addr)
+ *
+ * Description: back a faulting address in the stack, the heap or an mmap
+ *              area of the current process with a zeroed page
+ * Inputs: addr -- faulting virtual address (CR2)
+ * Outputs: None
+ * Return Value: 0 if the page was mapped, -1 if the access is invalid
+ */
+int32_t handle_demand_fault(uint32_t addr) {
+    pcb_t* pcb;
+    uint32_t frame;
+    int i, valid = 0;
+    if (addr < VM_START_ADDR || addr >= MMAP_END_ADDR)
+        return -1;
+    pcb = get_pcb();
+
+    // the stack grows down towards the image, at most USER_STACK_MAX bytes
+    if (addr < VM_END_ADDR && addr >= VM_END_ADDR - USER_STACK_MAX && addr >= PAGE_ALIGN_UP(pcb->image_end))
+        valid = 1;
+    // heap pages are valid up to the page containing the break
+    if (addr >= HEAP_START_ADDR && addr < PAGE_ALIGN_UP(pcb->heap_brk))
+        valid = 1;
+    for (i = 0; i < MAX_MMAP_AREAS && !valid; i++) {
+        if (addr >= pcb->mmap_area[i].start && addr < pcb->mmap_area[i].end)
+            valid = 1;
+    }
+    if (!valid)
+        return -1;
+
+    frame = alloc_zeroed_frame();
+    if (frame == 0)
+        return -1;
+    if (map_user_page(pcb, PAGE_ALIGN_DOWN(addr), frame) == -1) {
+        free_frame(frame);
+        return -1;
+    }
+    return 0;
+}
@@ -1,18 +1,46 @@
 #ifndef __PAGING_H
 #define __PAGING_H
 #include "types.h"
+#include "system_calls.h"
 #ifndef ASM
 
+#define PAGE_ALIGN_UP(addr)   (((addr) + 0xFFF) & 0xFFFFF000)
+#define PAGE_ALIGN_DOWN(addr) ((addr) & 0xFFFFF000)
+
 /* initialize paging by setting up page directory and page table */
 extern void page_init();
-/* map virtual address to physical address */
-extern void map_4MB_page(uint32_t pid);
+/* install the user page tables of process pid */
+extern void map_process_pages(uint32_t pid);
 /* map video memory address into user space */
 extern void map_video_mem(uint32_t addr);
-/* map page table entry to updated video buffer */
-extern void map_video_page(uint32_t addr);
-/* map a 4KB page in page table */
-extern void map_4KB_page(uint32_t physical);
+/* identity map low memory in [start, end) for the kernel */
+extern void map_low_range(uint32_t start, uint32_t end);
+/* undo map_low_range */
+extern void unmap_low_range(uint32_t start, uint32_t end);
+/* map a 4MB uncached region of device memory for the kernel */
+extern void map_mmio_4MB(uint32_t physical);
+/* allocate a 4KB physical frame from the frame pool */
+extern uint32_t alloc_frame();
+/* allocate a zero-filled 4KB physical frame */
+extern uint32_t alloc_zeroed_frame();
+/* zero free frames ahead of time, called from the idle loop */
+extern void refill_zero_pool();
+/* return a 4KB physical frame to the frame pool */
+extern void free_frame(uint32_t frame);
+/* reset the per-process page tables, heap and mappings of a new process */
+extern void init_user_pages(pcb_t* pcb);
+/* map a 4KB user page of the current process */
+extern int32_t map_user_page(pcb_t* pcb, uint32_t virtual_addr, uint32_t frame);
+/* back the user pages in [start, end) with zeroed frames */
+extern int32_t map_user_range(pcb_t* pcb, uint32_t start, uint32_t end);
+/* unmap and free the user pages in [start, end) */
+extern void unmap_user_range(pcb_t* pcb, uint32_t start, uint32_t end);
+/* unmap user pages in [start, end) without freeing frames another process may share */
+extern void detach_user_range(pcb_t* pcb, uint32_t start, uint32_t end);
+/* free every page and page table owned by a process */
+extern void free_user_pages(pcb_t* pcb);
+/* map a demand-zero page for a fault in the stack, heap or an mmap area */
+extern int32_t handle_demand_fault(uint32_t addr);
 
 #endif
 #endif
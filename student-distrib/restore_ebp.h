@@ -1,11 +0,0 @@
-#ifndef _RESTORE_EBP_H
-#define _RESTORE_EBP_H
-
-#ifndef ASM  
-
-/* Save all current registers and call keyboard handler */
-extern uint32_t get_ebp();
-
-
-#endif
-#endif
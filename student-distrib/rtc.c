@@ -2,6 +2,8 @@
 #include "lib.h"
 #include "i8259.h"
 #include "terminal.h"
+#include "schedule.h"
+#include "softirq.h"
 
 // Reference: https://wiki.osdev.org/RTC
 // default RTC frequency = 2Hz
@@ -11,39 +13,71 @@
 #define RTC_DEFAULT_RATE    RTC_MAX_FREQ / RTC_DEFAULT_FREQ
 // magic number (2^15) used to convert frequency to rate
 #define LOG_RATE_LIMIT      32768
+// ticks between framebuffer redraws of vidmap output (~30 per second)
+#define CONSOLE_SYNC_TICKS  32
 
 // RTC interrupt flags for each terminal
 volatile int32_t rtc_interrupt_flags[TERMINAL_COUNT];
 // RTC rtc rates for each eterminal
 volatile int32_t rtc_rates[TERMINAL_COUNT] = {RTC_DEFAULT_RATE, RTC_DEFAULT_RATE, RTC_DEFAULT_RATE};
+// processes blocked in rtc_read, one queue per terminal
+static wait_queue_t rtc_wait[TERMINAL_COUNT];
+// protects the interrupt flags and rates
+static spinlock_t rtc_lock = SPIN_LOCK_UNLOCKED;
 // counter used to virtualize RTC
-int32_t rtc_counter;
+volatile int32_t rtc_counter;
+// last tick rtc_bh has delivered to the terminals
+static int32_t rtc_handled;
 
 /* rtc_handler
  *
  * Description: handler for RTC
- *							output data to the port and print "RTC"
+ *							acknowledge the interrupt and count the tick for rtc_bh
  * Inputs: None
  * Outputs: None
  * Return Value: None
- * Side Effects: print "RTC"
+ * Side Effects: raises SOFTIRQ_RTC
  */
 void rtc_handler(){
-  cli();
 	// select register C
 	outb(RTC_REG_C, RTC_REG_PORT);
 	// throw away contents
 	inb(RTC_RW_PORT);
-	int i;
   rtc_counter ++;
-  // reset interrupt flags
-	for (i = 0; i < TERMINAL_COUNT; i++){
-    if (rtc_counter % rtc_rates[i] == 0)
-		  rtc_interrupt_flags[i] = 0;
-	}
+  raise_softirq(SOFTIRQ_RTC);
 	// send EOI with RTC IRQ number
 	send_eoi(RTC_IRQ_NUM);
-  sti();
+}
+
+/* rtc_bh
+ *
+ * Description: bottom half for RTC, wake the terminals whose virtual
+ *							rate divides one of the ticks counted since the last run
+ * Inputs: None
+ * Outputs: None
+ * Return Value: None
+ * Side Effects: wakes processes blocked in rtc_read
+ */
+void rtc_bh(){
+	int i;
+  uint32_t flags;
+  int32_t sync = 0;
+  spin_lock_irqsave(&rtc_lock, flags);
+  while (rtc_handled != rtc_counter) {
+    rtc_handled++;
+    if (rtc_handled % CONSOLE_SYNC_TICKS == 0)
+      sync = 1;
+    // reset interrupt flags
+	  for (i = 0; i < TERMINAL_COUNT; i++){
+      if (rtc_handled % rtc_rates[i] == 0) {
+		    rtc_interrupt_flags[i] = 0;
+        wake_up(&rtc_wait[i]);
+      }
+	  }
+  }
+  spin_unlock_irqrestore(&rtc_lock, flags);
+  if (sync)
+    console_sync();
 }
 
 /* rtc_init
@@ -56,6 +90,8 @@ void rtc_handler(){
 */
 void rtc_init(){
   rtc_counter = 0;
+  rtc_handled = 0;
+  open_softirq(SOFTIRQ_RTC, rtc_bh);
   // select register B, and disable NMI
   outb(RTC_REG_B, RTC_REG_PORT);
   // read the current value of register B
@@ -100,14 +136,18 @@ int32_t rtc_close(int32_t fd){
 * Return Value: 0 if successful
 */
 int32_t rtc_read(int32_t fd, void* buf, int32_t nbytes){
+  uint32_t flags;
+  uint8_t term = get_pcb()->terminal_id;
+  spin_lock_irqsave(&rtc_lock, flags);
 	// set flag to be 1
-  rtc_interrupt_flags[cur_terminal] = 1;
-	sti();
-	// read until interrupt handler clears the flag
-	while (rtc_interrupt_flags[cur_terminal]){}
+  rtc_interrupt_flags[term] = 1;
+	// sleep until interrupt handler clears the flag
+	while (rtc_interrupt_flags[term]) {
+    sleep_on_lock(&rtc_wait[term], &rtc_lock);
+  }
 	// in case the flag is changed
-	rtc_interrupt_flags[cur_terminal] = 1;
-  cli();
+	rtc_interrupt_flags[term] = 1;
+  spin_unlock_irqrestore(&rtc_lock, flags);
 	return 0;
 }
 
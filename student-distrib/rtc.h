@@ -25,6 +25,9 @@ int32_t rtc_set_freq(int32_t freq);
 /* handler for RTC */
 extern void rtc_handler();
 
+/* bottom half for RTC */
+extern void rtc_bh();
+
 /* Open RTC */
 extern int32_t rtc_open(const uint8_t* filename);
 
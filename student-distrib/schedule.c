@@ -1,13 +1,15 @@
 #include "schedule.h"
 #include "system_calls.h"
-#include "restore_ebp.h"
 #include "i8259.h"
 #include "lib.h"
 #include "x86_desc.h"
 #include "paging.h"
 #include "terminal.h"
+#include "fpu.h"
+#include "softirq.h"
+#include "trace.h"
 
-#define PIT_MODE        0x36
+#define PIT_ONESHOT     0x30            // channel 0, lo/hi byte, mode 0
 #define PIT_IRQ         0
 #define CHANNEL_0       0x40
 #define MODE_REGISTER   0x43
@@ -20,69 +22,500 @@
 
 // initialize all counters to 0
 uint32_t intr_counter = 0;
-uint32_t counter = 0;
+
+// one FIFO of runnable processes per mlfq level, not including the one
+// on the CPU; bit i of run_bitmap is set while level i is non-empty
+static pcb_t* run_head[MLFQ_LEVELS];
+static pcb_t* run_tail[MLFQ_LEVELS];
+static uint32_t run_bitmap = 0;
+
+// protects the run queue and every wait queue
+static spinlock_t sched_lock = SPIN_LOCK_UNLOCKED;
+
+// slices handed out since the last priority boost
+static uint32_t boost_counter = 0;
+
+// the boot context, run whenever the run queue is empty
+static pcb_t* idle_pcb = NULL;
+
+// whether a one-shot slice timer is counting down
+static volatile int pit_armed = 0;
+
+// tsc value when cpu time was last charged to a process
+static uint64_t acct_stamp = 0;
 
 
 /*
- * int32_t pit_init();
+ * void idle_init();
  * Inputs: None
  * Return Value: None
- * Function: initialize pit and enable corresponding irq
+ * Function: turn the boot context into the idle task. boot.S puts the
+ *           boot stack in the IDLE_PID kernel stack slot, so get_pcb()
+ *           already points at its pcb. Call before enabling interrupts.
  */
-void pit_init() {
+void idle_init() {
+    idle_pcb = get_pcb();
+    idle_pcb->pid = IDLE_PID;
+    idle_pcb->parent_pid = IDLE_PID;
+    idle_pcb->terminal_id = 0;
+    idle_pcb->state = PROC_RUNNING;
+    idle_pcb->run_next = NULL;
+    idle_pcb->nice = MLFQ_LEVELS - 1;
+    idle_pcb->level = MLFQ_LEVELS - 1;
+    strcpy((int8_t*)idle_pcb->name, "idle");
+    idle_pcb->user_cycles = 0;
+    idle_pcb->kernel_cycles = 0;
+    idle_pcb->switches = 0;
+    acct_stamp = rdtsc();
+}
+
+/*
+ * uint64_t rdtsc();
+ * Inputs: None
+ * Return Value: current time stamp counter
+ * Function: read the cpu cycle counter
+ */
+uint64_t rdtsc() {
+    uint64_t tsc;
+    asm volatile ("rdtsc" : "=A"(tsc));
+    return tsc;
+}
+
+/*
+ * void acct_charge(int32_t user);
+ * Inputs: user -- nonzero if the time since the last charge was spent in
+ *                 user mode
+ * Return Value: None
+ * Function: charge the cycles since the last charge to the current process
+ */
+static void acct_charge(int32_t user) {
+    pcb_t * cur_pcb = get_pcb();
+    uint32_t flags;
+    uint64_t now;
+    // system calls run with interrupts on, keep the stamp consistent
+    cli_and_save(flags);
+    now = rdtsc();
+    if (user)
+        cur_pcb->user_cycles += now - acct_stamp;
+    else
+        cur_pcb->kernel_cycles += now - acct_stamp;
+    acct_stamp = now;
+    restore_flags(flags);
+}
+
+/*
+ * void acct_entry(uint32_t cs);
+ * Inputs: cs -- code segment of the interrupted context
+ * Return Value: None
+ * Function: called by the interrupt and system call linkage on entry, the
+ *           time up to now was user time if we came from ring 3
+ */
+void acct_entry(uint32_t cs) {
+    acct_charge((cs & 0x3) == 0x3);
+}
+
+/*
+ * void acct_exit();
+ * Inputs: None
+ * Return Value: None
+ * Function: called by the linkage right before iret, the time since entry
+ *           (or the last switch) was kernel time of the current process
+ */
+void acct_exit() {
+    acct_charge(0);
+}
+
+/*
+ * void idle_task();
+ * Inputs: None
+ * Return Value: None
+ * Function: idle loop of the boot context. Hands the CPU to a process as
+ *           soon as one is woken, otherwise zeroes free frames and halts
+ *           until the next interrupt. Never returns.
+ */
+void idle_task() {
+    while (1) {
+        cli();
+        // an interrupt handler woke something up, run it right away
+        if (run_bitmap != 0) {
+            schedule();
+            continue;
+        }
+        sti();
+        refill_zero_pool();
+        cli();
+        if (run_bitmap != 0)
+            continue;
+        // sti only takes effect after hlt starts, so no wakeup is missed
+        asm volatile ("sti; hlt");
+    }
+}
+
+/*
+ * void pit_arm();
+ * Inputs: None
+ * Return Value: None
+ * Function: program the pit to fire once after one time slice (20 ms)
+ */
+static void pit_arm() {
     int divisor = DIVISOR / FREQ;         // calculate divisor (20 ms = 50 Hz)
-    outb(PIT_MODE, MODE_REGISTER);        //set our command byte 0x36 (Mode 3)
+    outb(PIT_ONESHOT, MODE_REGISTER);     //set our command byte 0x30 (Mode 0)
     outb(divisor & LOW_BYTE, CHANNEL_0);  //set lower byte of divisor
-    outb(divisor >> EIGHT_SHIFT, CHANNEL_0);        //set higher byte of divisor, right shift 8 bits
+    outb(divisor >> EIGHT_SHIFT, CHANNEL_0);        //set higher byte of divisor, right shift 8 bits, starts counting
+    pit_armed = 1;
+}
+
+/*
+ * int32_t pit_init();
+ * Inputs: None
+ * Return Value: None
+ * Function: initialize pit and enable corresponding irq. The pit runs
+ *           tickless: a one-shot slice is armed only while some process
+ *           is waiting in the run queue, and the first one starts the
+ *           terminal shells.
+ */
+void pit_init() {
+    pit_arm();
     enable_irq(PIT_IRQ);
     return;
 }
 
+/*
+ * int32_t runqueue_top_level();
+ * Inputs: None
+ * Return Value: best level with a runnable process, -1 if none
+ * Function: find the first non-empty mlfq level with one bsf
+ */
+static int32_t runqueue_top_level() {
+    int32_t level;
+    if (run_bitmap == 0)
+        return -1;
+    asm volatile ("bsfl %1, %0" : "=r"(level) : "r"(run_bitmap));
+    return level;
+}
+
+/*
+ * void runqueue_enqueue(pcb_t* pcb);
+ * Inputs: pcb -- process that is ready to run
+ * Return Value: None
+ * Function: append a process to the tail of its level's queue in O(1)
+ */
+void runqueue_enqueue(pcb_t* pcb) {
+    uint32_t level = pcb->level;
+    spin_lock(&sched_lock);
+    pcb->state = PROC_RUNNABLE;
+    pcb->run_next = NULL;
+    if (run_tail[level] == NULL)
+        run_head[level] = pcb;
+    else
+        run_tail[level]->run_next = pcb;
+    run_tail[level] = pcb;
+    run_bitmap |= 1 << level;
+    spin_unlock(&sched_lock);
+    // a running process now has competition, so its slice has to end;
+    // the idle task switches right away and context_switch arms instead
+    if (!pit_armed && get_pcb() != idle_pcb)
+        pit_arm();
+}
+
+/*
+ * pcb_t* runqueue_dequeue();
+ * Inputs: None
+ * Return Value: first process of the best non-empty level, NULL if the
+ *               run queue is empty
+ * Function: pick the next process to run in O(1)
+ */
+pcb_t* runqueue_dequeue() {
+    int32_t level;
+    pcb_t* pcb;
+    spin_lock(&sched_lock);
+    level = runqueue_top_level();
+    if (level < 0) {
+        spin_unlock(&sched_lock);
+        return NULL;
+    }
+    pcb = run_head[level];
+    run_head[level] = pcb->run_next;
+    if (run_head[level] == NULL) {
+        run_tail[level] = NULL;
+        run_bitmap &= ~(1 << level);
+    }
+    pcb->run_next = NULL;
+    spin_unlock(&sched_lock);
+    return pcb;
+}
+
+/*
+ * void runqueue_boost();
+ * Inputs: None
+ * Return Value: None
+ * Function: move every queued process back to its nice level so demoted
+ *           cpu-bound processes cannot starve forever
+ */
+static void runqueue_boost() {
+    pcb_t* list = NULL;
+    pcb_t* pcb;
+    int32_t level;
+
+    // unlink all levels into one list, best level first
+    spin_lock(&sched_lock);
+    for (level = MLFQ_LEVELS - 1; level >= 0; level--) {
+        if (run_tail[level] != NULL) {
+            run_tail[level]->run_next = list;
+            list = run_head[level];
+        }
+        run_head[level] = NULL;
+        run_tail[level] = NULL;
+    }
+    run_bitmap = 0;
+    spin_unlock(&sched_lock);
+
+    while (list != NULL) {
+        pcb = list;
+        list = list->run_next;
+        pcb->level = pcb->nice;
+        runqueue_enqueue(pcb);
+    }
+}
+
 /*
  * int32_t pit_schedule();
  * Inputs: None
  * Return Value: None
  * Function: Handle pit interrupts, calls execute shell on the first three
-             interrupts to open up three terminals
+             interrupts to open up three terminals, then round-robins over
+             every runnable process regardless of its terminal
  */
 void pit_schedule(){
     send_eoi(PIT_IRQ);
+    pit_armed = 0;
+    // never switch away from a bottom half, the rest of them would stall
+    // behind it; the process gets a fresh slice instead
+    if (in_softirq()) {
+        pit_arm();
+        return;
+    }
     pcb_t * cur_pcb = get_pcb();
-    cur_pcb->my_ebp = get_ebp();
+    pcb_t * next_pcb;
 
-    cur_terminal = counter % TERMINAL_COUNT;
-    counter = (counter + 1) % TERMINAL_COUNT;   // increment counter
     uint8_t command_str[FIVE_LEN] = "shell";           // a five character string "shell" to input into execute
 
     if(intr_counter < TERMINAL_COUNT){
+      // the interrupted shell keeps running once the new one is started
+      if (cur_pcb != idle_pcb)
+        runqueue_enqueue(cur_pcb);
       // start all three shell
+      cur_terminal = intr_counter;
       intr_counter++;
+      // keep ticking until every terminal has its shell
+      if (!pit_armed)
+        pit_arm();
       execute((uint8_t*)command_str);
     }
     else {
-        context_switch();
+        // nothing else is runnable, keep the current process and stay
+        // tickless until something is woken up
+        if (run_bitmap == 0)
+            return;
+
+        if (++boost_counter >= MLFQ_BOOST_SLICES) {
+            boost_counter = 0;
+            runqueue_boost();
+            if (cur_pcb != idle_pcb)
+                cur_pcb->level = cur_pcb->nice;
+        }
+        // the slice was used up, so the process looks cpu-bound
+        else if (cur_pcb != idle_pcb && cur_pcb->level < MLFQ_LEVELS - 1)
+            cur_pcb->level++;
+
+        // keep running if everything waiting is at a worse level
+        if (cur_pcb != idle_pcb && (int32_t)cur_pcb->level < runqueue_top_level()) {
+            pit_arm();
+            return;
+        }
+
+        next_pcb = runqueue_dequeue();
+        // the idle task never waits in the run queue
+        if (cur_pcb != idle_pcb) {
+            trace_event(TRACE_PREEMPT, cur_pcb->level);
+            runqueue_enqueue(cur_pcb);
+        }
+        context_switch(next_pcb);
     }
     return;
 }
 
 /*
- * int32_t context_switch();
+ * void schedule();
  * Inputs: None
  * Return Value: None
- * Function: Do context switch, paging and restore ebp for switching terminals
- */
-void context_switch() {
-    int switch_pid = terminal[cur_terminal].active_process;
-    map_4MB_page(switch_pid);
-    tss.ss0 = KERNEL_DS;
-    tss.esp0 = _8MB - switch_pid * _8KB;
-    // increment switch_pid to get the next 8KB pcb index
-    pcb_t * next_pcb = (pcb_t*) (_8MB - (switch_pid + 1) * _8KB);
-
-    asm volatile(
-        "movl %0, %%ebp;"   // restore ebp
-        :
-        :"r"(next_pcb->my_ebp)
-    );
-    return;
+ * Function: switch to the next runnable process. The caller must already
+ *           have taken the current process off the CPU (e.g. sleep_on).
+ *           Switches to the idle task if nothing is runnable.
+ */
+void schedule() {
+    pcb_t * cur_pcb = get_pcb();
+    pcb_t * next_pcb = runqueue_dequeue();
+
+    if (next_pcb == NULL) {
+        if (cur_pcb == idle_pcb)
+            return;
+        next_pcb = idle_pcb;
+    }
+    context_switch(next_pcb);
+}
+
+/*
+ * void sleep_on(wait_queue_t* wq);
+ * Inputs: wq -- wait queue to sleep on
+ * Return Value: None
+ * Function: block the current process on wq and run something else.
+ *           Returns after wake_up(wq) once the process is scheduled again.
+ *           Must be called with interrupts disabled, and the caller should
+ *           recheck its condition in a loop.
+ */
+void sleep_on(wait_queue_t* wq) {
+    pcb_t * cur_pcb = get_pcb();
+
+    spin_lock(&sched_lock);
+    cur_pcb->state = PROC_SLEEPING;
+    cur_pcb->run_next = NULL;
+    if (wq->tail == NULL)
+        wq->head = cur_pcb;
+    else
+        wq->tail->run_next = cur_pcb;
+    wq->tail = cur_pcb;
+    spin_unlock(&sched_lock);
+
+    trace_event(TRACE_BLOCK, 0);
+    schedule();
+}
+
+/*
+ * void sleep_on_lock(wait_queue_t* wq, spinlock_t* lock);
+ * Inputs: wq -- wait queue to sleep on
+ *         lock -- spinlock protecting the condition the caller waits for
+ * Return Value: None
+ * Function: sleep_on for callers holding a spinlock with interrupts off.
+ *           The lock is dropped only after the process is on wq, so a
+ *           wake_up issued under the same lock cannot be missed.
+ */
+void sleep_on_lock(wait_queue_t* wq, spinlock_t* lock) {
+    pcb_t * cur_pcb = get_pcb();
+
+    spin_lock(&sched_lock);
+    cur_pcb->state = PROC_SLEEPING;
+    cur_pcb->run_next = NULL;
+    if (wq->tail == NULL)
+        wq->head = cur_pcb;
+    else
+        wq->tail->run_next = cur_pcb;
+    wq->tail = cur_pcb;
+    spin_unlock(&sched_lock);
+
+    trace_event(TRACE_BLOCK, 0);
+    spin_unlock(lock);
+    schedule();
+    spin_lock(lock);
+}
+
+/*
+ * void mutex_lock(mutex_t* mutex);
+ * Inputs: mutex -- mutex to acquire
+ * Return Value: None
+ * Function: take the mutex, sleeping (with interrupts on for everyone
+ *           else) while another process holds it. Process context only.
+ */
+void mutex_lock(mutex_t* mutex) {
+    uint32_t flags;
+    spin_lock_irqsave(&mutex->lock, flags);
+    while (mutex->locked)
+        sleep_on_lock(&mutex->waiters, &mutex->lock);
+    mutex->locked = 1;
+    spin_unlock_irqrestore(&mutex->lock, flags);
+}
+
+/*
+ * void mutex_unlock(mutex_t* mutex);
+ * Inputs: mutex -- mutex held by the caller
+ * Return Value: None
+ * Function: release the mutex and let its waiters compete for it again
+ */
+void mutex_unlock(mutex_t* mutex) {
+    uint32_t flags;
+    spin_lock_irqsave(&mutex->lock, flags);
+    mutex->locked = 0;
+    wake_up(&mutex->waiters);
+    spin_unlock_irqrestore(&mutex->lock, flags);
+}
+
+/*
+ * void wake_up(wait_queue_t* wq);
+ * Inputs: wq -- wait queue to wake
+ * Return Value: None
+ * Function: move every sleeper on wq to the run queue, in order
+ */
+void wake_up(wait_queue_t* wq) {
+    pcb_t * pcb;
+    pcb_t * next;
+
+    spin_lock(&sched_lock);
+    pcb = wq->head;
+    wq->head = NULL;
+    wq->tail = NULL;
+    spin_unlock(&sched_lock);
+    while (pcb != NULL) {
+        next = pcb->run_next;
+        trace_event(TRACE_WAKE, pcb->pid);
+        runqueue_enqueue(pcb);
+        pcb = next;
+    }
+}
+
+/*
+ * void wake_up_interactive(wait_queue_t* wq);
+ * Inputs: wq -- wait queue to wake
+ * Return Value: None
+ * Function: like wake_up, but the sleepers were waiting on the user (e.g.
+ *           keyboard input), so they go back to their best level
+ */
+void wake_up_interactive(wait_queue_t* wq) {
+    pcb_t * pcb;
+    spin_lock(&sched_lock);
+    for (pcb = wq->head; pcb != NULL; pcb = pcb->run_next)
+        pcb->level = pcb->nice;
+    spin_unlock(&sched_lock);
+    wake_up(wq);
+}
+
+/*
+ * int32_t context_switch(pcb_t* next_pcb);
+ * Inputs: next_pcb -- process to switch to
+ * Return Value: None
+ * Function: Do context switch, paging and switch kernel stacks. Returns
+ *           once the current process is switched back to.
+ */
+void context_switch(pcb_t* next_pcb) {
+    pcb_t * cur_pcb = get_pcb();
+    int switch_pid = next_pcb->pid;
+    // the outgoing process pays for the kernel time up to the switch
+    acct_charge(0);
+    cur_pcb->switches++;
+    next_pcb->state = PROC_RUNNING;
+    // the fpu registers are switched lazily, in fpu_trap
+    fpu_switch(next_pcb);
+    // the idle task never enters user space, so it borrows whatever
+    // user mappings and esp0 are loaded instead of flushing the TLB
+    if (next_pcb != idle_pcb) {
+        cur_terminal = next_pcb->terminal_id;
+        map_process_pages(switch_pid);
+        tss.ss0 = KERNEL_DS;
+        tss.esp0 = _8MB - switch_pid * _8KB;
+        // others are waiting, bound the slice of the incoming process
+        if (run_bitmap != 0 && !pit_armed)
+            pit_arm();
+    }
+
+    trace_event(TRACE_SWITCH, switch_pid);
+    switch_to(&cur_pcb->context, &next_pcb->context);
 }
@@ -1,14 +1,61 @@
 #ifndef _SCHEDULE_H
 #define _SCHEDULE_H
 #include "types.h"
+#include "system_calls.h"
+#include "lock.h"
+
+/* FIFO of processes sleeping on an event, linked through run_next */
+typedef struct {
+    pcb_t* head;
+    pcb_t* tail;
+} wait_queue_t;
+
+#define IDLE_PID    MAX_NUM_FILE    // kernel stack slot of the idle task
+
+/* sleeping lock for long critical sections in process context */
+typedef struct {
+    spinlock_t lock;                // protects the fields below
+    uint32_t locked;
+    wait_queue_t waiters;
+} mutex_t;
+
+#define MUTEX_UNLOCKED  { SPIN_LOCK_UNLOCKED, 0, { NULL, NULL } }
 
 /* counter for opening first three terminals */
 extern uint32_t intr_counter;
+/* Set up the boot context as the idle task */
+void idle_init();
+/* Idle loop run when no process is runnable, never returns */
+void idle_task();
+/* Read the time stamp counter */
+uint64_t rdtsc();
+/* Charge cpu time on interrupt/system call entry */
+void acct_entry(uint32_t cs);
+/* Charge cpu time right before returning from an interrupt/system call */
+void acct_exit();
 /* Initialize pit */
 void pit_init();
 /* Handles pit interrupts */
 extern void pit_schedule();
 /* Handles context switch */
-void context_switch();
+void context_switch(pcb_t* next_pcb);
+/* Append a runnable process to the run queue */
+void runqueue_enqueue(pcb_t* pcb);
+/* Take the next process to run from the run queue */
+pcb_t* runqueue_dequeue();
+/* Give up the CPU to the next runnable process */
+void schedule();
+/* Put the current process to sleep on a wait queue */
+void sleep_on(wait_queue_t* wq);
+/* Release a spinlock, sleep on a wait queue, then take the lock again */
+void sleep_on_lock(wait_queue_t* wq, spinlock_t* lock);
+/* Acquire a mutex, sleeping while another process holds it */
+void mutex_lock(mutex_t* mutex);
+/* Release a mutex and wake its waiters */
+void mutex_unlock(mutex_t* mutex);
+/* Move every process sleeping on a wait queue back to the run queue */
+void wake_up(wait_queue_t* wq);
+/* Wake processes that waited on the user and boost their priority */
+void wake_up_interactive(wait_queue_t* wq);
 
 #endif
@@ -0,0 +1,389 @@
+#include "serial.h"
+#include "lib.h"
+#include "i8259.h"
+#include "lock.h"
+#include "schedule.h"
+#include "softirq.h"
+
+int32_t serial_present = 0;
+// protects everything below, taken by the handler with interrupts off
+static spinlock_t serial_lock = SPIN_LOCK_UNLOCKED;
+// bytes waiting for the transmit FIFO, free running indices
+static uint8_t tx_ring[SERIAL_TX_SIZE];
+static uint32_t tx_head;
+static uint32_t tx_tail;
+// set while the transmit interrupt is enabled and will drain tx_ring
+static int32_t tx_busy;
+// bytes the transmitter takes per interrupt, 1 without working FIFOs
+static uint32_t tx_fifo_size;
+// kernel output lost since the last "[N bytes dropped]" marker
+static uint32_t tx_dropped;
+// bytes received, waiting for serial_bh
+static uint8_t rx_ring[SERIAL_RX_SIZE];
+static uint32_t rx_head;
+static uint32_t rx_tail;
+// complete lines readers may take, free running indices
+static uint8_t ready[SERIAL_READY_SIZE];
+static uint32_t ready_head;
+static uint32_t ready_tail;
+static uint32_t ready_lines;
+// line being typed
+static uint8_t line[SERIAL_LINE_SIZE];
+static uint32_t line_len;
+// processes waiting for a line and for room in tx_ring
+static wait_queue_t serial_read_wait;
+static wait_queue_t serial_write_wait;
+// one reader at a time consumes a line
+static mutex_t serial_read_mutex = MUTEX_UNLOCKED;
+
+/* tx_fill
+ *
+ * Description: move queued bytes into the transmit FIFO, turning the
+ *							transmit interrupt off once the queue is empty
+ * Inputs: None
+ * Outputs: None
+ * Return Value: None
+ * Side Effects: called from the handler with serial_lock held
+ */
+static void tx_fill(){
+  uint32_t n;
+  for (n = 0; n < tx_fifo_size && tx_head != tx_tail; n++) {
+    outb(tx_ring[tx_head % SERIAL_TX_SIZE], COM1_PORT + UART_DATA);
+    tx_head++;
+  }
+  if (n == 0) {
+    tx_busy = 0;
+    outb(IER_RX | IER_LINE, COM1_PORT + UART_IER);
+  }
+}
+
+/* tx_queue
+ *
+ * Description: append a byte for the transmitter and make sure the
+ *							transmit interrupt is on to send it
+ * Inputs: c -- byte to send
+ * Outputs: None
+ * Return Value: 0 if queued, -1 if tx_ring is full
+ * Side Effects: called with serial_lock held
+ */
+static int32_t tx_queue(uint8_t c){
+  if (tx_tail - tx_head >= SERIAL_TX_SIZE)
+    return -1;
+  tx_ring[tx_tail % SERIAL_TX_SIZE] = c;
+  tx_tail++;
+  if (!tx_busy) {
+    // the UART raises the interrupt at once since its FIFO is empty
+    tx_busy = 1;
+    outb(IER_RX | IER_LINE | IER_TX, COM1_PORT + UART_IER);
+  }
+  return 0;
+}
+
+/* tx_poll
+ *
+ * Description: make room in tx_ring without the interrupt, which is off
+ *							during boot and in printf, by waiting for the transmitter
+ *							and feeding it directly. Bytes still leave in order.
+ * Inputs: n -- bytes of room needed
+ * Outputs: None
+ * Return Value: 0 once there is room, -1 if the UART stopped draining
+ * Side Effects: called with serial_lock held
+ */
+static int32_t tx_poll(uint32_t n){
+  uint32_t i = 0;
+  while (SERIAL_TX_SIZE - (tx_tail - tx_head) < n) {
+    if (inb(COM1_PORT + UART_LSR) & LSR_TX_EMPTY) {
+      tx_fill();
+      i = 0;
+    }
+    else if (++i >= SERIAL_POLL_LIMIT) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* serial_input
+ *
+ * Description: edit and echo the typed line, handing it to readers on
+ *							Enter. Terminals send '\r' for Enter and DEL for Backspace.
+ * Inputs: c -- received byte
+ * Outputs: None
+ * Return Value: None
+ * Side Effects: called from serial_bh with serial_lock held
+ */
+static void serial_input(uint8_t c){
+  uint32_t i;
+  switch (c) {
+    case '\r':
+    case '\n':
+      // a line that does not fit is dropped whole
+      if (ready_tail - ready_head + line_len + 1 <= SERIAL_READY_SIZE) {
+        for (i = 0; i < line_len; i++)
+          ready[(ready_tail++) % SERIAL_READY_SIZE] = line[i];
+        ready[(ready_tail++) % SERIAL_READY_SIZE] = '\n';
+        ready_lines++;
+      }
+      line_len = 0;
+      tx_queue('\r');
+      tx_queue('\n');
+      break;
+
+    case '\b':
+    case 0x7F:
+      if (line_len > 0) {
+        line_len--;
+        tx_queue('\b');
+        tx_queue(' ');
+        tx_queue('\b');
+      }
+      break;
+
+    default:
+      // keep room for the '\n'
+      if (c >= ' ' && line_len < SERIAL_LINE_SIZE - 1) {
+        line[line_len++] = c;
+        tx_queue(c);
+      }
+      break;
+  }
+}
+
+/* serial_bh
+ *
+ * Description: bottom half for COM1, run the received bytes through the
+ *							line editor and wake readers and writers
+ * Inputs: None
+ * Outputs: None
+ * Return Value: None
+ * Side Effects: wakes processes blocked in serial_read and serial_write
+ */
+static void serial_bh(){
+  uint32_t flags;
+  spin_lock_irqsave(&serial_lock, flags);
+  while (rx_head != rx_tail) {
+    serial_input(rx_ring[rx_head % SERIAL_RX_SIZE]);
+    rx_head++;
+  }
+  if (ready_lines != 0)
+    wake_up_interactive(&serial_read_wait);
+  if (tx_tail - tx_head <= SERIAL_TX_SIZE / 2)
+    wake_up(&serial_write_wait);
+  spin_unlock_irqrestore(&serial_lock, flags);
+}
+
+/* serial_handler
+ *
+ * Description: handler for COM1, service every pending cause: keep the
+ *							transmit FIFO fed and move received bytes to rx_ring
+ * Inputs: None
+ * Outputs: None
+ * Return Value: None
+ * Side Effects: raises SOFTIRQ_SERIAL for input and waiting writers
+ */
+void serial_handler(){
+  uint8_t iir, c;
+  spin_lock(&serial_lock);
+  while (!((iir = inb(COM1_PORT + UART_IIR)) & IIR_NO_INT)) {
+    switch (iir & IIR_ID_MASK) {
+      case IIR_RX_DATA:
+      case IIR_RX_TIMEOUT:
+        while (inb(COM1_PORT + UART_LSR) & LSR_DATA_READY) {
+          c = inb(COM1_PORT + UART_DATA);
+          // drop the byte if the bottom half is that far behind
+          if (rx_tail - rx_head < SERIAL_RX_SIZE)
+            rx_ring[(rx_tail++) % SERIAL_RX_SIZE] = c;
+        }
+        raise_softirq(SOFTIRQ_SERIAL);
+        break;
+
+      case IIR_TX_EMPTY:
+        tx_fill();
+        if (serial_write_wait.head != NULL && tx_tail - tx_head <= SERIAL_TX_SIZE / 2)
+          raise_softirq(SOFTIRQ_SERIAL);
+        break;
+
+      case IIR_LINE_STATUS:
+        // reading the status clears overrun and framing errors
+        inb(COM1_PORT + UART_LSR);
+        break;
+
+      default:
+        inb(COM1_PORT + UART_MSR);
+        break;
+    }
+  }
+  spin_unlock(&serial_lock);
+  send_eoi(SERIAL_IRQ_NUM);
+}
+
+/* serial_init
+ *
+ * Description: Initialize COM1 at 115200 baud 8N1 with its FIFOs on
+ * Inputs: None
+ * Outputs: None
+ * Return Value: 0 on success, -1 if there is no UART
+ * Side Effects: turns on IRQ4 and starts mirroring kernel output
+ */
+int32_t serial_init(){
+  // a missing port reads back as 0xFF
+  outb(SCRATCH_TEST, COM1_PORT + UART_SCRATCH);
+  if (inb(COM1_PORT + UART_SCRATCH) != SCRATCH_TEST)
+    return -1;
+
+  outb(0, COM1_PORT + UART_IER);
+  outb(LCR_DLAB, COM1_PORT + UART_LCR);
+  outb(SERIAL_BAUD_DIVISOR & 0xFF, COM1_PORT + UART_DLL);
+  outb(SERIAL_BAUD_DIVISOR >> 8, COM1_PORT + UART_DLM);
+  outb(LCR_8N1, COM1_PORT + UART_LCR);
+  outb(FCR_ENABLE_14, COM1_PORT + UART_FCR);
+  tx_fifo_size = (inb(COM1_PORT + UART_IIR) & IIR_FIFO_ENABLED) == IIR_FIFO_ENABLED ? SERIAL_FIFO_SIZE : 1;
+  outb(MCR_DTR_RTS_OUT2, COM1_PORT + UART_MCR);
+  // throw away anything pending from before
+  inb(COM1_PORT + UART_LSR);
+  inb(COM1_PORT + UART_DATA);
+  inb(COM1_PORT + UART_MSR);
+  outb(IER_RX | IER_LINE, COM1_PORT + UART_IER);
+
+  open_softirq(SOFTIRQ_SERIAL, serial_bh);
+  enable_irq(SERIAL_IRQ_NUM);
+  serial_present = 1;
+  return 0;
+}
+
+/* serial_putc
+ *
+ * Description: mirror a character of kernel output to COM1. A full queue
+ *							is drained by polling, so long logs are not cut short;
+ *							only if the UART stops draining is output dropped, and
+ *							a "[N bytes dropped]" marker follows once it drains again.
+ * Inputs: c -- character printed
+ * Outputs: None
+ * Return Value: None
+ * Side Effects: may spin at line rate while the queue is full
+ */
+void serial_putc(uint8_t c){
+  int8_t mark[SERIAL_MARK_SIZE];
+  uint32_t flags, i;
+  if (!serial_present)
+    return;
+  spin_lock_irqsave(&serial_lock, flags);
+  if (tx_dropped != 0 && tx_poll(SERIAL_MARK_SIZE + 2) == 0) {
+    i = strlen(itoa(tx_dropped, mark, 10));
+    strcpy(mark + i, " bytes dropped]\r\n");
+    tx_queue('[');
+    for (i = 0; mark[i] != '\0'; i++)
+      tx_queue(mark[i]);
+    tx_dropped = 0;
+  }
+  if (tx_dropped == 0 && tx_poll(2) == 0) {
+    if (c == '\n')
+      tx_queue('\r');
+    tx_queue(c);
+  }
+  else {
+    tx_dropped += (c == '\n') ? 2 : 1;
+  }
+  spin_unlock_irqrestore(&serial_lock, flags);
+}
+
+/* serial_open
+ *
+ * Description: open the serial terminal
+ * Inputs: filename -- unused
+ * Outputs: None
+ * Return Value: 0 on success, -1 if there is no UART
+ * Side Effects: None
+ */
+int32_t serial_open(const uint8_t* filename){
+  return serial_present ? 0 : -1;
+}
+
+/* serial_close
+ *
+ * Description: close the serial terminal
+ * Inputs: fd -- unused
+ * Outputs: None
+ * Return Value: 0
+ * Side Effects: None
+ */
+int32_t serial_close(int32_t fd){
+  return 0;
+}
+
+/* serial_read
+ *
+ * Description: wait for a line typed on the serial terminal
+ * Inputs: fd -- unused
+ *         buf -- where to store the line
+ *         nbytes -- size of buf
+ * Outputs: None
+ * Return Value: bytes read, at most one line including its '\n'
+ * Side Effects: sleeps until Enter is received
+ */
+int32_t serial_read(int32_t fd, void* buf, int32_t nbytes){
+  uint8_t chunk[SERIAL_LINE_SIZE];
+  uint32_t flags;
+  int32_t count = 0;
+  uint8_t c;
+
+  if (buf == NULL || nbytes < 0)
+    return -1;
+  if (nbytes > SERIAL_LINE_SIZE)
+    nbytes = SERIAL_LINE_SIZE;
+  mutex_lock(&serial_read_mutex);
+  spin_lock_irqsave(&serial_lock, flags);
+  while (ready_lines == 0)
+    sleep_on_lock(&serial_read_wait, &serial_lock);
+  while (count < nbytes) {
+    c = ready[(ready_head++) % SERIAL_READY_SIZE];
+    chunk[count++] = c;
+    if (c == '\n') {
+      ready_lines--;
+      break;
+    }
+  }
+  spin_unlock_irqrestore(&serial_lock, flags);
+  mutex_unlock(&serial_read_mutex);
+  // copy after unlocking so a fault on the user buffer is not taken under the lock
+  memcpy(buf, chunk, count);
+  return count;
+}
+
+/* serial_write
+ *
+ * Description: queue a buffer for the serial port, '\n' is sent as "\r\n"
+ * Inputs: fd -- unused
+ *         buf -- bytes to send
+ *         nbytes -- number of bytes
+ * Outputs: None
+ * Return Value: nbytes, or -1 if buf is NULL
+ * Side Effects: sleeps while the transmit queue is full
+ */
+int32_t serial_write(int32_t fd, const void* buf, int32_t nbytes){
+  uint8_t chunk[SERIAL_CHUNK];
+  uint32_t flags;
+  int32_t count = 0, len, i;
+
+  if (buf == NULL)
+    return -1;
+  while (count < nbytes) {
+    len = nbytes - count;
+    if (len > SERIAL_CHUNK)
+      len = SERIAL_CHUNK;
+    // copy first so a fault on the user buffer is not taken under the lock
+    memcpy(chunk, (uint8_t*)buf + count, len);
+    spin_lock_irqsave(&serial_lock, flags);
+    for (i = 0; i < len; i++) {
+      // room for a '\r' as well
+      while (tx_tail - tx_head > SERIAL_TX_SIZE - 2)
+        sleep_on_lock(&serial_write_wait, &serial_lock);
+      if (chunk[i] == '\n')
+        tx_queue('\r');
+      tx_queue(chunk[i]);
+    }
+    spin_unlock_irqrestore(&serial_lock, flags);
+    count += len;
+  }
+  return count;
+}
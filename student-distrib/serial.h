@@ -0,0 +1,75 @@
+#ifndef _SERIAL_H
+#define _SERIAL_H
+#include "types.h"
+
+#ifndef ASM
+
+#define COM1_PORT           0x3F8
+#define SERIAL_BAUD_DIVISOR 1       // 115200 baud
+#define SERIAL_TX_SIZE      4096    // bytes queued for the UART, a power of two
+#define SERIAL_RX_SIZE      256     // bytes received ahead of the bottom half, a power of two
+#define SERIAL_LINE_SIZE    128     // longest line a reader gets, '\n' included
+#define SERIAL_READY_SIZE   256     // typed lines waiting for readers, a power of two
+#define SERIAL_CHUNK        256     // bytes copied from user space per lock hold
+#define SERIAL_FIFO_SIZE    16      // transmit FIFO of a 16550A
+#define SERIAL_POLL_LIMIT   100000  // LSR reads before kernel output is dropped
+#define SERIAL_MARK_SIZE    32      // room for "[N bytes dropped]\r\n"
+#define SERIAL_DEV_NAME     "serial"  // name open() knows the port by
+
+// 16550 registers, offsets from the base port
+#define UART_DATA           0       // receive buffer / transmit holding
+#define UART_IER            1       // interrupt enable
+#define UART_IIR            2       // interrupt identification (read)
+#define UART_FCR            2       // FIFO control (write)
+#define UART_LCR            3       // line control
+#define UART_MCR            4       // modem control
+#define UART_LSR            5       // line status
+#define UART_MSR            6       // modem status
+#define UART_SCRATCH        7
+#define UART_DLL            0       // divisor latch, while LCR_DLAB is set
+#define UART_DLM            1
+
+#define IER_RX              0x01    // received data and receive timeout
+#define IER_TX              0x02    // transmit holding register empty
+#define IER_LINE            0x04    // receive line status
+#define IIR_NO_INT          0x01
+#define IIR_ID_MASK         0x0E
+#define IIR_TX_EMPTY        0x02
+#define IIR_RX_DATA         0x04
+#define IIR_LINE_STATUS     0x06
+#define IIR_RX_TIMEOUT      0x0C
+#define IIR_FIFO_ENABLED    0xC0    // both set on a 16550A with working FIFOs
+#define FCR_ENABLE_14       0xC7    // enable and clear both FIFOs, interrupt at 14 bytes
+#define LCR_8N1             0x03
+#define LCR_DLAB            0x80
+#define MCR_DTR_RTS_OUT2    0x0B    // OUT2 connects the interrupt line to the PIC
+#define LSR_DATA_READY      0x01
+#define LSR_TX_EMPTY        0x20    // transmit holding register (and FIFO) empty
+#define SCRATCH_TEST        0x5A
+
+// set once a UART was found on COM1
+extern int32_t serial_present;
+
+/* set up COM1 and enable its IRQ */
+extern int32_t serial_init();
+
+/* handler for COM1 */
+extern void serial_handler();
+
+/* queue a character of kernel output, polling the UART if the queue is full */
+extern void serial_putc(uint8_t c);
+
+/* function to open the serial terminal */
+extern int32_t serial_open(const uint8_t* filename);
+
+/* function to close the serial terminal */
+extern int32_t serial_close(int32_t fd);
+
+/* function to read a line typed on the serial terminal */
+extern int32_t serial_read(int32_t fd, void* buf, int32_t nbytes);
+
+/* function to send a buffer out of the serial port */
+extern int32_t serial_write(int32_t fd, const void* buf, int32_t nbytes);
+
+#endif
+#endif
@@ -0,0 +1,221 @@
+#include "shm.h"
+#include "paging.h"
+#include "lib.h"
+#include "schedule.h"
+
+#define NOT_IN_USE  0
+
+// segments are identified by their index in this table, key 0 marks a free slot
+shm_segment_t shm_table[MAX_SHM_SEGMENTS];
+// held across table updates, which may zero up to MAX_SHM_PAGES frames
+static mutex_t shm_mutex = MUTEX_UNLOCKED;
+
+/* shm_release
+ *
+ * Description: free the frames of a segment nobody is attached to any more
+ * Inputs: seg -- segment to release
+ * Outputs: None
+ * Return Value: None
+ * Side Effects: None
+ */
+static void shm_release(shm_segment_t* seg){
+  int i;
+  for (i = 0; i < seg->num_pages; i++)
+    free_frame(seg->frames[i]);
+  seg->num_pages = 0;
+  seg->key = NOT_IN_USE;
+}
+
+/*
+ * int32_t shmget_locked(int32_t key, uint32_t size)
+ * Inputs: int32_t key -- nonzero key shared by the cooperating processes
+ *         uint32_t size -- size of the segment in bytes
+ * Return Value: segment id, or -1 for failure
+ * Function: return the segment for key, creating it with zeroed frames if
+ *           it does not exist yet
+ */
+static int32_t shmget_locked(int32_t key, uint32_t size){
+  int i, id = -1;
+  uint32_t num_pages;
+  // checked before rounding, which wraps to 0 for sizes near 4 GB
+  if (key == NOT_IN_USE || size == 0 || size > (MAX_SHM_PAGES << 12))
+    return -1;
+  num_pages = PAGE_ALIGN_UP(size) >> 12;
+
+  for (i = 0; i < MAX_SHM_SEGMENTS; i++) {
+    // an existing segment must be large enough for the caller
+    if (shm_table[i].key == key)
+      return (shm_table[i].num_pages >= num_pages) ? i : -1;
+    if (shm_table[i].key == NOT_IN_USE && id == -1)
+      id = i;
+  }
+  if (id == -1)
+    return -1;
+
+  for (i = 0; i < num_pages; i++) {
+    shm_table[id].frames[i] = alloc_zeroed_frame();
+    if (shm_table[id].frames[i] == 0) {
+      shm_table[id].num_pages = i;
+      shm_release(&shm_table[id]);
+      return -1;
+    }
+  }
+  shm_table[id].key = key;
+  shm_table[id].num_pages = num_pages;
+  shm_table[id].attach_count = 0;
+  shm_table[id].creator_pid = get_pcb()->pid;
+  return id;
+}
+
+/*
+ * int32_t shmat_locked(int32_t id, void* addr)
+ * Inputs: int32_t id -- segment id returned by shmget
+ *         void* addr -- page aligned address to attach at, or NULL to let the kernel choose
+ * Return Value: start address of the attachment, or -1 for failure
+ * Function: map the frames of a segment into the current process so several
+ *           processes see the same memory
+ */
+static int32_t shmat_locked(int32_t id, void* addr){
+  pcb_t* pcb = get_pcb();
+  uint32_t start, end, i;
+  int j, slot = -1;
+  if (id < 0 || id >= MAX_SHM_SEGMENTS || shm_table[id].key == NOT_IN_USE)
+    return -1;
+
+  for (j = 0; j < MAX_SHM_ATTACH; j++) {
+    if (pcb->shm_attach[j].id == -1) {
+      slot = j;
+      break;
+    }
+  }
+  if (slot == -1)
+    return -1;
+
+  if (addr != NULL) {
+    start = (uint32_t)addr;
+    if (start != PAGE_ALIGN_DOWN(start))
+      return -1;
+  }
+  else {
+    // first fit: move past every attachment that overlaps the candidate range
+    start = SHM_START_ADDR;
+    for (j = 0; j < MAX_SHM_ATTACH; j++) {
+      if (pcb->shm_attach[j].id != -1 && start < pcb->shm_attach[j].end &&
+          pcb->shm_attach[j].start < start + (shm_table[id].num_pages << 12)) {
+        start = pcb->shm_attach[j].end;
+        j = -1;
+      }
+    }
+  }
+  end = start + (shm_table[id].num_pages << 12);
+  if (start < SHM_START_ADDR || end > SHM_END_ADDR || end < start)
+    return -1;
+  for (j = 0; j < MAX_SHM_ATTACH; j++) {
+    if (pcb->shm_attach[j].id != -1 && start < pcb->shm_attach[j].end && pcb->shm_attach[j].start < end)
+      return -1;
+  }
+
+  // share the segment frames through the process page tables
+  for (i = 0; i < shm_table[id].num_pages; i++) {
+    if (map_user_page(pcb, start + (i << 12), shm_table[id].frames[i]) == -1) {
+      detach_user_range(pcb, start, start + (i << 12));
+      return -1;
+    }
+  }
+  pcb->shm_attach[slot].id = id;
+  pcb->shm_attach[slot].start = start;
+  pcb->shm_attach[slot].end = end;
+  shm_table[id].attach_count++;
+  return start;
+}
+
+/*
+ * int32_t shmdt_locked(void* addr)
+ * Inputs: void* addr -- address returned by shmat
+ * Return Value: 0 on success, -1 if nothing is attached there
+ * Function: unmap a segment from the current process; the segment is freed
+ *           once the last process detaches
+ */
+static int32_t shmdt_locked(void* addr){
+  pcb_t* pcb = get_pcb();
+  int j, id;
+  for (j = 0; j < MAX_SHM_ATTACH; j++) {
+    if (pcb->shm_attach[j].id != -1 && pcb->shm_attach[j].start == (uint32_t)addr) {
+      id = pcb->shm_attach[j].id;
+      detach_user_range(pcb, pcb->shm_attach[j].start, pcb->shm_attach[j].end);
+      pcb->shm_attach[j].id = -1;
+      if (--shm_table[id].attach_count == 0)
+        shm_release(&shm_table[id]);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/*
+ * void shm_detach_all(pcb_t* pcb)
+ * Inputs: pcb_t* pcb -- pcb of the halting (current) process
+ * Return Value: None
+ * Function: detach every segment before the process pages are freed, so
+ *           frames still used by other processes are not released, and
+ *           free the segments the process created that were never attached
+ */
+void shm_detach_all(pcb_t* pcb){
+  int j;
+  mutex_lock(&shm_mutex);
+  for (j = 0; j < MAX_SHM_ATTACH; j++) {
+    if (pcb->shm_attach[j].id != -1)
+      shmdt_locked((void*)pcb->shm_attach[j].start);
+  }
+  // shmdt only frees on the last detach, which these never see
+  for (j = 0; j < MAX_SHM_SEGMENTS; j++) {
+    if (shm_table[j].key != NOT_IN_USE && shm_table[j].attach_count == 0 &&
+        shm_table[j].creator_pid == pcb->pid)
+      shm_release(&shm_table[j]);
+  }
+  mutex_unlock(&shm_mutex);
+}
+
+/*
+ * int32_t shmget(int32_t key, uint32_t size)
+ * Inputs: int32_t key -- nonzero key shared by the cooperating processes
+ *         uint32_t size -- size of the segment in bytes
+ * Return Value: segment id, or -1 for failure
+ * Function: shmget system call, serialized on shm_mutex
+ */
+int32_t shmget(int32_t key, uint32_t size){
+  int32_t ret;
+  mutex_lock(&shm_mutex);
+  ret = shmget_locked(key, size);
+  mutex_unlock(&shm_mutex);
+  return ret;
+}
+
+/*
+ * int32_t shmat(int32_t id, void* addr)
+ * Inputs: int32_t id -- segment id returned by shmget
+ *         void* addr -- where to attach, NULL to let the kernel choose
+ * Return Value: address of the segment, or -1 for failure
+ * Function: shmat system call, serialized on shm_mutex
+ */
+int32_t shmat(int32_t id, void* addr){
+  int32_t ret;
+  mutex_lock(&shm_mutex);
+  ret = shmat_locked(id, addr);
+  mutex_unlock(&shm_mutex);
+  return ret;
+}
+
+/*
+ * int32_t shmdt(void* addr)
+ * Inputs: void* addr -- address returned by shmat
+ * Return Value: 0 on success, -1 if nothing is attached there
+ * Function: shmdt system call, serialized on shm_mutex
+ */
+int32_t shmdt(void* addr){
+  int32_t ret;
+  mutex_lock(&shm_mutex);
+  ret = shmdt_locked(addr);
+  mutex_unlock(&shm_mutex);
+  return ret;
+}
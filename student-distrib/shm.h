@@ -0,0 +1,31 @@
+#ifndef _SHM_H
+#define _SHM_H
+
+#include "types.h"
+#include "system_calls.h"
+
+#define MAX_SHM_SEGMENTS    8
+#define MAX_SHM_PAGES       64    // 256 KB per segment
+
+/* shared memory segment */
+typedef struct {
+    int32_t key;
+    uint32_t num_pages;
+    uint32_t attach_count;
+    uint32_t creator_pid;               // frees the segment at its halt if nobody attached
+    uint32_t frames[MAX_SHM_PAGES];
+} shm_segment_t;
+
+/* find or create the segment for key */
+int32_t shmget(int32_t key, uint32_t size);
+
+/* attach a segment to the current process */
+int32_t shmat(int32_t id, void* addr);
+
+/* detach a segment from the current process */
+int32_t shmdt(void* addr);
+
+/* detach every segment of a halting process */
+void shm_detach_all(pcb_t* pcb);
+
+#endif
@@ -0,0 +1,68 @@
+#include "softirq.h"
+#include "lib.h"
+
+static softirq_handler_t softirq_vec[NR_SOFTIRQS];
+// one bit per softirq raised since the last drain
+static volatile uint32_t softirq_pending;
+// set while do_softirq drains, so nested interrupts only raise
+static volatile uint32_t softirq_running;
+
+/*
+ * void open_softirq(uint32_t nr, softirq_handler_t handler);
+ * Inputs: uint32_t nr -- SOFTIRQ_* number
+ *         softirq_handler_t handler -- bottom half to run for it
+ * Return Value: None
+ * Function: register the bottom half of a driver
+ */
+void open_softirq(uint32_t nr, softirq_handler_t handler) {
+    if (nr < NR_SOFTIRQS)
+        softirq_vec[nr] = handler;
+}
+
+/*
+ * void raise_softirq(uint32_t nr);
+ * Inputs: uint32_t nr -- SOFTIRQ_* number
+ * Return Value: None
+ * Function: mark a bottom half pending, it runs when the interrupt returns
+ */
+void raise_softirq(uint32_t nr) {
+    softirq_pending |= 1 << nr;
+}
+
+/*
+ * void do_softirq();
+ * Inputs: None
+ * Return Value: None
+ * Function: run the pending bottom halves with interrupts enabled, until
+ *           no more are raised. Entered and left with interrupts off. A
+ *           nested call, from an interrupt taken while draining, returns
+ *           at once and leaves its work to the outer loop.
+ */
+void do_softirq() {
+    uint32_t pending, nr;
+
+    if (softirq_running || softirq_pending == 0)
+        return;
+    softirq_running = 1;
+    while ((pending = softirq_pending) != 0) {
+        softirq_pending = 0;
+        sti();
+        for (nr = 0; nr < NR_SOFTIRQS; nr++) {
+            if ((pending & (1 << nr)) && softirq_vec[nr] != NULL)
+                softirq_vec[nr]();
+        }
+        cli();
+    }
+    softirq_running = 0;
+}
+
+/*
+ * int32_t in_softirq();
+ * Inputs: None
+ * Return Value: 1 while bottom halves are running, 0 otherwise
+ * Function: lets the scheduler avoid switching away from a bottom half,
+ *           which would stall every other bottom half until it ran again
+ */
+int32_t in_softirq() {
+    return softirq_running != 0;
+}
@@ -0,0 +1,23 @@
+#ifndef _SOFTIRQ_H
+#define _SOFTIRQ_H
+
+#include "types.h"
+
+#define SOFTIRQ_KEYBOARD    0       // decode queued scancodes
+#define SOFTIRQ_RTC         1       // wake rtc readers for the ticks seen
+#define SOFTIRQ_SERIAL      2       // edit received serial input, wake serial writers
+#define NR_SOFTIRQS         3
+
+/* bottom half, runs with interrupts on and must not sleep */
+typedef void (*softirq_handler_t)(void);
+
+/* Register the bottom half for a softirq number */
+void open_softirq(uint32_t nr, softirq_handler_t handler);
+/* Mark a softirq pending, called from a top half with interrupts off */
+void raise_softirq(uint32_t nr);
+/* Run pending bottom halves, called on interrupt exit with interrupts off */
+void do_softirq();
+/* Check whether bottom halves are running on this cpu */
+int32_t in_softirq();
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _SWITCH_H
+#define _SWITCH_H
+
+// offsets of the fields of context_t, shared with switch.S
+#define CTX_EBX     0
+#define CTX_ESI     4
+#define CTX_EDI     8
+#define CTX_EBP     12
+#define CTX_ESP     16
+#define CTX_EIP     20
+
+#ifndef ASM
+
+#include "types.h"
+
+/* registers a kernel stack keeps across switch_to, the caller-saved ones
+ * are dead at the call by the C calling convention */
+typedef struct {
+    uint32_t ebx;
+    uint32_t esi;
+    uint32_t edi;
+    uint32_t ebp;
+    uint32_t esp;
+    uint32_t eip;
+} __attribute__((packed)) context_t;
+
+/* Save the current registers into prev and resume the context in next */
+extern void switch_to(context_t* prev, context_t* next);
+
+#endif /* ASM */
+#endif /* _SWITCH_H */
@@ -6,13 +6,21 @@
 #include "x86_desc.h"
 #include "paging.h"
 #include "lib.h"
+#include "shm.h"
+#include "schedule.h"
+#include "lock.h"
+#include "fpu.h"
+#include "trace.h"
+#include "fb.h"
+#include "serial.h"
 
 
 #define IN_USE  1
 #define NOT_IN_USE 0
 
-int process_flag[MAX_NUM_FILE] = {NOT_IN_USE, NOT_IN_USE, NOT_IN_USE,
-  NOT_IN_USE, NOT_IN_USE, NOT_IN_USE};
+int process_flag[MAX_NUM_FILE] = {NOT_IN_USE};
+// protects process_flag
+static spinlock_t proc_lock = SPIN_LOCK_UNLOCKED;
 
 // function pointer arrays
 file_op_table_t stdin_func = {(void*)tread, (void*)invalid_return, (void*)topen, (void*)tclose};
@@ -20,6 +28,24 @@ file_op_table_t stdout_func = {(void*)invalid_return, (void*)twrite, (void*)tope
 file_op_table_t rtc_func = {(void*)rtc_read, (void*)rtc_write, (void*)rtc_open, (void*)rtc_close};
 file_op_table_t dir_func = {(void*)read_dir, (void*)write_dir, (void*)open_dir, (void*)close_dir};
 file_op_table_t file_func = {(void*)read_file, (void*)write_file, (void*)open_file, (void*)close_file};
+file_op_table_t serial_func = {(void*)serial_read, (void*)serial_write, (void*)serial_open, (void*)serial_close};
+
+/*
+ * int32_t lookup(const uint8_t* filename, dentry_t* dentry);
+ * Inputs: const uint8_t* filename -- name of file to open
+ *         dentry_t* dentry -- filled with the file's directory entry
+ * Return Value: 0 on success, -1 if there is no such file
+ * Function: Find a file in the file system, or the serial port, which is
+ *           a device outside the file system image
+ */
+static int32_t lookup(const uint8_t* filename, dentry_t* dentry){
+    if (strncmp((int8_t*)filename, (int8_t*)SERIAL_DEV_NAME, sizeof(SERIAL_DEV_NAME)) == 0) {
+      dentry->filetype = FILE_TYPE_SERIAL;
+      dentry->inode_num = 0;
+      return 0;
+    }
+    return read_dentry_by_name(filename, dentry);
+}
 
 /*
  * int32_t open(const uint8_t* filename);
@@ -32,7 +58,7 @@ int32_t open(const uint8_t* filename){
     int i;
     pcb_t* cur_pcb = get_pcb();
     // check if the file exists
-    if(read_dentry_by_name(filename, &dentry) == -1)
+    if(lookup(filename, &dentry) == -1)
       // return -1 if doesn't exist
       return -1;
     else {
@@ -73,6 +99,12 @@ int32_t open(const uint8_t* filename){
         cur_pcb->file_des[i].inode = dentry.inode_num;
         cur_pcb->file_des[i].file_pos = 0;
       }
+      else if (dentry.filetype == FILE_TYPE_SERIAL) {
+        cur_pcb->file_des[i].file_op_ptr = serial_func;
+        // set as default values
+        cur_pcb->file_des[i].inode = 0;
+        cur_pcb->file_des[i].file_pos = 0;
+      }
       else{
         cur_pcb->file_des[i].in_use_flag = NOT_IN_USE;
         // error
@@ -81,8 +113,11 @@ int32_t open(const uint8_t* filename){
     }
     int32_t ret_val = cur_pcb->file_des[i].file_op_ptr.open(filename);
     // return file index
-    if (ret_val != 0)
+    if (ret_val != 0) {
+        // e.g. the serial port is missing
+        cur_pcb->file_des[i].in_use_flag = NOT_IN_USE;
         return -1;
+    }
     return i;
 }
 
@@ -154,6 +189,26 @@ int32_t write(int32_t fd, const void* buf, int32_t nbytes){
     return ret_val;
 }
 
+/*
+ * int32_t ioctl(int32_t fd, int32_t request, int32_t arg)
+ * Inputs: int32_t fd -- file descriptor of the terminal
+ *         int32_t request -- TERM_GETMODE or TERM_SETMODE
+ *         int32_t arg -- argument of the request
+ * Return Value: int32_t -- -1 for error, otherwise the result of the request
+ * Function: change or query the mode of the calling process's terminal,
+ *           only stdin and stdout accept requests
+ */
+int32_t ioctl(int32_t fd, int32_t request, int32_t arg){
+    if (fd < 0 || fd >= FILE_NUM)
+        return -1;
+    pcb_t* cur_pcb = get_pcb();
+    if (cur_pcb->file_des[fd].in_use_flag == NOT_IN_USE)
+        return -1;
+    if (cur_pcb->file_des[fd].file_op_ptr.open != topen)
+        return -1;
+    return terminal_ioctl(cur_pcb->terminal_id, request, arg);
+}
+
 /*
  * pcb_t* get_pcb()
  * Inputs: None
@@ -189,16 +244,21 @@ int32_t invalid_return(){
  * Function: Execute corresponding command
  */
 int32_t execute(const uint8_t* command){
-  cli();
+  uint32_t flags;
   int pid;
   // check availability
+  spin_lock_irqsave(&proc_lock, flags);
   for (pid = 0; pid < MAX_NUM_FILE; pid++){
     if (process_flag[pid] == NOT_IN_USE) break;
   }
   // if no file blocks are available
-  if (pid == MAX_NUM_FILE) return -1;
+  if (pid == MAX_NUM_FILE) {
+    spin_unlock_irqrestore(&proc_lock, flags);
+    return -1;
+  }
   // else put it in use
   else process_flag[pid] = IN_USE;
+  spin_unlock_irqrestore(&proc_lock, flags);
 
   // parse arguments
   uint8_t cmd_buf[KEYBOARD_BUFFER_SIZE], arg_buf[KEYBOARD_BUFFER_SIZE];
@@ -206,14 +266,12 @@ int32_t execute(const uint8_t* command){
   // check if command and arguments are vaild
   if (parse_arg(command, cmd_buf, arg_buf) == -1) {
     process_flag[pid] = NOT_IN_USE;
-    sti();
     return -1;
   }
 
   // check file validity
   if(read_dentry_by_name(cmd_buf, &dentry) == -1) {
     process_flag[pid] = NOT_IN_USE;
-    sti();
     return -1;
   }
   // check if the file is vaild using empty magic buf
@@ -223,17 +281,29 @@ int32_t execute(const uint8_t* command){
   if (magic_buf[0] != MAGIC_BUF_0 || magic_buf[1] != MAGIC_BUF_1
     ||  magic_buf[2] != MAGIC_BUF_2 ||  magic_buf[3] != MAGIC_BUF_3) {
       process_flag[pid] = NOT_IN_USE;
-      sti();
       return -1;
     }
 
-  // set up paging
-  map_4MB_page(pid);
+  // from here on the page directory holds the child's pages; a switch
+  // would put the parent's back under us, so stay off until switch_to
+  cli();
+
+  // set up paging: map only the pages the image needs plus one stack page
+  pcb_t * child_pcb = (pcb_t*) (_8MB - (pid + 1) * _8KB);  // calculate new address for child pcb
+  uint32_t image_size = get_file_size(dentry.inode_num);
+  init_user_pages(child_pcb);
+  child_pcb->image_end = PROG_IMAGE_ADDR + image_size;
+  map_process_pages(pid);
+  if (image_size > VM_END_ADDR - PROG_IMAGE_ADDR - USER_STACK_MAX ||
+      map_user_range(child_pcb, PROG_IMAGE_ADDR, child_pcb->image_end) == -1 ||
+      map_user_range(child_pcb, USER_STACK_PAGE, VM_END_ADDR) == -1) {
+    exec_fail(child_pcb, pid);
+    return -1;
+  }
 
   // load file into memory
-  if (read_data(dentry.inode_num, 0, (uint8_t*)PROG_IMAGE_ADDR, (_4MB-PI_OFFSET)) == -1){
-    process_flag[pid] = NOT_IN_USE;
-    sti();
+  if (read_data(dentry.inode_num, 0, (uint8_t*)PROG_IMAGE_ADDR, image_size) == -1){
+    exec_fail(child_pcb, pid);
     return -1;
   }
 
@@ -246,11 +316,20 @@ int32_t execute(const uint8_t* command){
   entry_pt |= entry_pt_buf[2] << SHIFT_16_BITS; // set byte 26
   entry_pt |= entry_pt_buf[1] << SHIFT_8_BITS; // set byte 25
   entry_pt |= entry_pt_buf[0]; // set byte 24
+  child_pcb->entry_pt = entry_pt;
 
   // create PCB
-  pcb_t * child_pcb = (pcb_t*) (_8MB - (pid + 1) * _8KB);  // calculate new address for child pcb
   child_pcb->pid = pid;
   child_pcb->status_excep = 0;
+  child_pcb->state = PROC_RUNNING;
+  child_pcb->run_next = NULL;
+  child_pcb->user_cycles = 0;
+  child_pcb->kernel_cycles = 0;
+  child_pcb->switches = 0;
+  child_pcb->fpu_used = 0;
+  strncpy((int8_t*)child_pcb->name, (int8_t*)cmd_buf, PROC_NAME_LEN - 1);
+  child_pcb->name[PROC_NAME_LEN - 1] = '\0';
+  trace_event(TRACE_EXEC, pid);
   uint32_t len_arg_buf = strlen((int8_t*)arg_buf);
   memcpy((int8_t*)child_pcb->arg_buf, (int8_t*)arg_buf, len_arg_buf);
   child_pcb->arg_buf[len_arg_buf] = '\0';
@@ -261,11 +340,15 @@ int32_t execute(const uint8_t* command){
   if (pid == 0 || pid == 1 || pid == 2) {
       //child_pcb->terminal_id = pid;
       child_pcb->parent_pid = pid;
+      child_pcb->nice = 0;
   }
   else {
       child_pcb->parent_pid = get_pcb()->pid;   // set parent pid to previous pid
-
+      child_pcb->nice = get_pcb()->nice;        // children inherit the parent's nice
+      // the parent sleeps in execute, off the run queue, until the child halts
+      get_pcb()->state = PROC_WAIT_CHILD;
   }
+  child_pcb->level = child_pcb->nice;      // new processes start at their best level
 
   child_pcb->file_des[0].file_op_ptr = stdin_func;  // set file operation pointer to stdin
   child_pcb->file_des[1].file_op_ptr = stdout_func; // set next file operation pointer to stdout
@@ -282,12 +365,39 @@ int32_t execute(const uint8_t* command){
   // prepare for context switch
   tss.ss0 = KERNEL_DS;
   tss.esp0 = _8MB - pid * _8KB;
-  uint32_t temp;
-
-  // save parent ebp
-  asm volatile("movl %%ebp, %0" : "=r"(temp));
-  child_pcb->parent_ebp = temp;
+  // the parent's fpu registers may still be loaded
+  fpu_switch(child_pcb);
+
+  // the parent pays for loading the child, which starts in user mode
+  acct_exit();
+
+  // a shell restarted by halt reuses the stack we are running on
+  if (child_pcb == get_pcb())
+    enter_user(entry_pt);
+
+  // the child starts in user_start on its empty kernel stack, one dummy
+  // return address below the top
+  child_pcb->context.esp = _8MB - pid * _8KB - FOUR_BYTES;
+  child_pcb->context.ebp = 0;
+  child_pcb->context.eip = (uint32_t)user_start;
+  switch_to(&get_pcb()->context, &child_pcb->context);
+
+  // a terminal's first shell was started from the pit, which gets back
+  // here when its interrupted process is scheduled again
+  if (pid == 0 || pid == 1 || pid == 2)
+    return 0;
+  // otherwise the child halted and switched back to us
+  return get_pcb()->child_status;
+}
 
+/*
+ * void enter_user(uint32_t entry_pt)
+ * Inputs: uint32_t entry_pt -- user address to start at
+ * Return Value: None, never returns
+ * Function: iret into the program mapped in the current page directory,
+ *           with a fresh user stack and interrupts enabled
+ */
+void enter_user(uint32_t entry_pt){
   // push iret context onto stack
   asm volatile (
       "pushl $0x002B;"        // push user DS
@@ -304,16 +414,37 @@ int32_t execute(const uint8_t* command){
 
       "pushl %0;"         // push EIP
       "iret;"
-
-      "FROM_HALT:;"       //LABEL for halt to jump back
-      "leave;"
-      "ret;"
       :
       :"r" (entry_pt) //input
       :"%eax"
   );
+}
 
-  return 0;
+/*
+ * void user_start()
+ * Inputs: None
+ * Return Value: None, never returns
+ * Function: first code a new process runs, switch_to enters it on the
+ *           child's own kernel stack
+ */
+void user_start(){
+  enter_user(get_pcb()->entry_pt);
+}
+
+
+/*
+ * void exec_fail(pcb_t* child_pcb, int pid)
+ * Inputs: pcb_t* child_pcb -- pcb of the process that failed to load
+ *         int pid -- its pid
+ * Return Value: None
+ * Function: undo a partially loaded program and restore the caller's pages
+ */
+void exec_fail(pcb_t* child_pcb, int pid){
+  free_user_pages(child_pcb);
+  process_flag[pid] = NOT_IN_USE;
+  // a child process returns to its parent, whose pages must come back
+  if (pid >= TERMINAL_COUNT)
+    map_process_pages(get_pcb()->pid);
 }
 
 
@@ -390,31 +521,37 @@ int32_t parse_arg(const uint8_t* command, uint8_t* cmd_buf, uint8_t* arg_buf){
  * Function: Halt current process and return to execute
  */
 int32_t halt(uint8_t status){
-  // clears keyboard buffer
-    int j = 0;
-    for (j = 0; j < key_buffer_index[cur_terminal]; j++) {
-      keyboard_buffer[cur_terminal][j] = NULL;
-    }
-    key_buffer_index[cur_terminal] = 0;
-
-    for (j = 0; j < term_buffer_index[cur_terminal]; j++) {
-      terminal_buffer[cur_terminal][j] = NULL;
-    }
-    term_buffer_index[cur_terminal] = 0;
+  // the address space is torn down and we leave on the parent's stack,
+  // nothing may switch away in between
+  cli();
+  // drop typed input and any raw mode the program left behind
+    spin_lock(&console_lock);
+    ldisc_flush(cur_terminal);
+    spin_unlock(&console_lock);
 
     pcb_t * cur_pcb = get_pcb();
+    trace_event(TRACE_EXIT, status);
+    // release the program image, stack, heap and anonymous mappings
+    shm_detach_all(cur_pcb);
+    fb_release(cur_pcb);
+    free_user_pages(cur_pcb);
+    fpu_release(cur_pcb);
     if (terminal[cur_pcb->terminal_id].fish_check != 0) {
       terminal[cur_pcb->terminal_id].fish_check--;
     }
     // if current shell is the last shell, start a new shell
     if (cur_pcb->pid == 0 || cur_pcb->pid == 1 || cur_pcb->pid == 2) {
+        spin_lock(&proc_lock);
         process_flag[cur_pcb->pid] = NOT_IN_USE;
+        spin_unlock(&proc_lock);
         // first command is "shell", length = 5
         uint8_t command_str[5] = "shell";
         execute((uint8_t*)command_str);
     }
     else{
+      spin_lock(&proc_lock);
       process_flag[cur_pcb->pid] = NOT_IN_USE;         // set process as not in use
+      spin_unlock(&proc_lock);
 
       // close ALL relevant FDs
       int i;
@@ -422,28 +559,19 @@ int32_t halt(uint8_t status){
           close(i);
       }
 
-      //restore parent paging
-      map_4MB_page(cur_pcb->parent_pid);
-
+      pcb_t * parent_pcb = (pcb_t*) (_8MB - (cur_pcb->parent_pid + 1) * _8KB);
       terminal[cur_terminal].active_process = cur_pcb->parent_pid;
 
-      //restore stack pointer
-      tss.esp0 = _8MB - cur_pcb->parent_pid * _8KB;
-
-    }
-    uint32_t status_check = (uint32_t)status;
-    if (cur_pcb->status_excep){
-      status_check = HALT_BY_EXCEP;
+      uint32_t status_check = (uint32_t)status;
+      if (cur_pcb->status_excep){
+        status_check = HALT_BY_EXCEP;
+      }
+      // the parent returns from switch_to in execute with the status;
+      // context_switch restores its paging and esp0 and charges and traces
+      // the switch like any other
+      parent_pcb->child_status = status_check;
+      context_switch(parent_pcb);
     }
-    // jump to execute return
-    asm volatile(
-        "movl %0, %%eax;"
-        "movl %1, %%ebp;"   // restore parent ebp
-        "jmp FROM_HALT;"
-        :
-        :"r"(status_check), "r"(cur_pcb->parent_ebp)
-        :"%eax"
-    );
       // return -1 if didn't return properly to execute
       return -1;
 }
@@ -487,11 +615,17 @@ int32_t vidmap(uint8_t** screen_start){
   if ((uint32_t)screen_start < VM_START_ADDR || (uint32_t)screen_start >= VM_END_ADDR)
     return -1;
   // arbitrarily assign video memory virtual address
+  uint32_t flags;
+  spin_lock_irqsave(&console_lock, flags);
   uint32_t virtual_addr = VM_END_ADDR + (screen_terminal)*_4KB;
+  // the program draws at the start of the terminal's video memory, so
+  // stop showing a scrolled window
+  reset_origin(screen_terminal);
   map_video_mem(virtual_addr);
+  terminal[screen_terminal].fish_check++;
+  spin_unlock_irqrestore(&console_lock, flags);
   // make the start of the screen points to the virtual address assigned
   *screen_start = (uint8_t*) virtual_addr;
-  terminal[screen_terminal].fish_check++;
   return virtual_addr;
 }
 
@@ -505,3 +639,163 @@ int32_t set_handler(int32_t signum, void* handler_address){
 int32_t sigreturn(void){
   return -1;
 }
+
+
+/*
+ * int32_t sbrk(int32_t increment)
+ * Inputs: int32_t increment -- number of bytes to grow (or shrink) the heap by
+ * Return Value: previous program break, or -1 if the new break is out of range
+ * Function: move the program break; pages are only backed when first touched
+ */
+int32_t sbrk(int32_t increment){
+  pcb_t* pcb = get_pcb();
+  uint32_t old_brk = pcb->heap_brk;
+  uint32_t new_brk = old_brk + increment;
+  // reject wrap-around and breaks outside the heap region
+  if ((increment > 0 && new_brk < old_brk) || (increment < 0 && new_brk > old_brk))
+    return -1;
+  if (new_brk < HEAP_START_ADDR || new_brk > HEAP_END_ADDR)
+    return -1;
+  // release pages that now lie entirely above the break
+  if (new_brk < old_brk)
+    unmap_user_range(pcb, PAGE_ALIGN_UP(new_brk), PAGE_ALIGN_UP(old_brk));
+  pcb->heap_brk = new_brk;
+  return old_brk;
+}
+
+/*
+ * int32_t mmap(void* addr, uint32_t length)
+ * Inputs: void* addr -- page aligned address to map at, or NULL to let the kernel choose
+ *         uint32_t length -- size of the mapping in bytes
+ * Return Value: start address of the mapping, or -1 if it cannot be placed
+ * Function: create an anonymous mapping backed by demand-zero pages
+ */
+int32_t mmap(void* addr, uint32_t length){
+  pcb_t* pcb = get_pcb();
+  uint32_t start, end;
+  int i, slot = -1;
+  if (length == 0 || length > MMAP_END_ADDR - MMAP_START_ADDR)
+    return -1;
+  length = PAGE_ALIGN_UP(length);
+
+  // find an unused area slot
+  for (i = 0; i < MAX_MMAP_AREAS; i++) {
+    if (pcb->mmap_area[i].start == pcb->mmap_area[i].end) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot == -1)
+    return -1;
+
+  if (addr != NULL) {
+    start = (uint32_t)addr;
+    if (start != PAGE_ALIGN_DOWN(start))
+      return -1;
+  }
+  else {
+    // first fit: move past every area that overlaps the candidate range
+    start = MMAP_START_ADDR;
+    for (i = 0; i < MAX_MMAP_AREAS; i++) {
+      if (start < pcb->mmap_area[i].end && pcb->mmap_area[i].start < start + length) {
+        start = pcb->mmap_area[i].end;
+        i = -1;
+      }
+    }
+  }
+  end = start + length;
+  if (start < MMAP_START_ADDR || end > MMAP_END_ADDR || end < start)
+    return -1;
+  for (i = 0; i < MAX_MMAP_AREAS; i++) {
+    if (start < pcb->mmap_area[i].end && pcb->mmap_area[i].start < end)
+      return -1;
+  }
+
+  pcb->mmap_area[slot].start = start;
+  pcb->mmap_area[slot].end = end;
+  return start;
+}
+
+/*
+ * int32_t munmap(void* addr, uint32_t length)
+ * Inputs: void* addr -- start address returned by mmap
+ *         uint32_t length -- length passed to mmap
+ * Return Value: 0 on success, -1 if no such mapping exists
+ * Function: remove an anonymous mapping and free the pages it touched
+ */
+int32_t munmap(void* addr, uint32_t length){
+  pcb_t* pcb = get_pcb();
+  int i;
+  for (i = 0; i < MAX_MMAP_AREAS; i++) {
+    if (pcb->mmap_area[i].start != pcb->mmap_area[i].end &&
+        pcb->mmap_area[i].start == (uint32_t)addr &&
+        pcb->mmap_area[i].end - pcb->mmap_area[i].start == PAGE_ALIGN_UP(length)) {
+      unmap_user_range(pcb, pcb->mmap_area[i].start, pcb->mmap_area[i].end);
+      pcb->mmap_area[i].start = 0;
+      pcb->mmap_area[i].end = 0;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/*
+ * int32_t nice(int32_t inc)
+ * Inputs: int32_t inc -- amount to add to the nice value, negative raises
+ *                        the priority
+ * Return Value: the new nice value
+ * Function: nice is the best mlfq level the process can reach, clamped to
+ *           0..MLFQ_LEVELS-1. The current level is moved to it so the
+ *           change takes effect from the next slice.
+ */
+int32_t nice(int32_t inc){
+  pcb_t* pcb = get_pcb();
+  int32_t value = (int32_t)pcb->nice + inc;
+  if (value < 0)
+    value = 0;
+  if (value > MLFQ_LEVELS - 1)
+    value = MLFQ_LEVELS - 1;
+  pcb->nice = value;
+  pcb->level = value;
+  return value;
+}
+
+/*
+ * int32_t getprocs(proc_info_t* buf, int32_t count)
+ * Inputs: proc_info_t* buf -- user buffer for the snapshot
+ *         int32_t count -- number of entries buf can hold
+ * Return Value: number of entries written, -1 if buf is invalid
+ * Function: copy pid, scheduling state and cpu time of every live
+ *           process, followed by the idle task, into buf
+ */
+int32_t getprocs(proc_info_t* buf, int32_t count){
+  pcb_t* pcb;
+  int32_t pid;
+  int32_t n = 0;
+  if (buf == NULL || count <= 0)
+    return -1;
+  // bound count before multiplying so a huge count cannot wrap the sum
+  if ((uint32_t)count > (USER_END_ADDR - VM_START_ADDR) / sizeof(proc_info_t) ||
+      (uint32_t)buf < VM_START_ADDR || (uint32_t)buf > USER_END_ADDR ||
+      count * sizeof(proc_info_t) > USER_END_ADDR - (uint32_t)buf)
+    return -1;
+
+  // pid IDLE_PID is the slot right after the last process
+  for (pid = 0; pid <= IDLE_PID && n < count; pid++) {
+    if (pid != IDLE_PID && process_flag[pid] == NOT_IN_USE)
+      continue;
+    pcb = (pcb_t*) (_8MB - (pid + 1) * _8KB);
+    buf[n].pid = pcb->pid;
+    buf[n].parent_pid = pcb->parent_pid;
+    buf[n].terminal_id = pcb->terminal_id;
+    buf[n].state = pcb->state;
+    buf[n].nice = pcb->nice;
+    buf[n].level = pcb->level;
+    buf[n].switches = pcb->switches;
+    buf[n].user_cycles = pcb->user_cycles;
+    buf[n].kernel_cycles = pcb->kernel_cycles;
+    memcpy(buf[n].name, pcb->name, PROC_NAME_LEN);
+    n++;
+  }
+  return n;
+}
@@ -2,9 +2,10 @@
 #define SYSTEM_CALLS_H
 
 #include "types.h"
+#include "switch.h"
 
 #define FILE_NUM              8
-#define MAX_NUM_FILE          6
+#define MAX_NUM_FILE          16
 #define MIN_FILE_IDX          2
 #define PCB_MASK              0xFFFFE000      //mask lower 13 bits
 #define _8MB                  0x800000
@@ -13,6 +14,8 @@
 #define _4KB                  0x1000
 #define PROG_IMAGE_ADDR       0x08048000
 #define PI_OFFSET             0x48000
+#define USER_STACK_PAGE       0x83FF000  // page holding the initial user stack
+#define USER_STACK_MAX        0x100000   // stack may grow to 1 MB below VM_END_ADDR
 #define KEYBOARD_BUFFER_SIZE  128
 #define FOUR_BYTES            4
 #define SHIFT_24_BITS         24
@@ -22,6 +25,7 @@
 #define FILE_TYPE_RTC         0
 #define FILE_TYPE_DIR         1
 #define FILE_TYPE_FILE        2
+#define FILE_TYPE_SERIAL      3          // COM1, not in the file system image
 #define VM_START_ADDR         0x8000000  // 128 MB
 #define VM_END_ADDR           0x8400000  // 132 MB
 #define HALT_BY_EXCEP         256
@@ -30,9 +34,40 @@
 #define MAGIC_BUF_2           0x4c
 #define MAGIC_BUF_3           0x46
 
-
-
-// 6 processes max
+// user virtual memory layout above the program image
+#define USER_PD_IDX           32         // PDE of the program image (128 MB)
+#define USER_PT_COUNT         13         // user PDEs a process may back with its own page tables
+#define USER_PT_FIRST_SLOT    0          // first slot in user_pt[] owned by the process
+#define VIDMAP_PT_SLOT        1          // PDE 33 is shared with vidmap
+#define HEAP_START_ADDR       0x8800000  // 136 MB, initial program break
+#define HEAP_END_ADDR         0x9800000  // 152 MB, heap grows at most 16 MB
+#define MMAP_START_ADDR       0x9800000  // 152 MB, anonymous mappings
+#define MMAP_END_ADDR         0xA800000  // 168 MB
+#define MAX_MMAP_AREAS        8
+#define SHM_START_ADDR        0xA800000  // 168 MB, shared memory attachments
+#define SHM_END_ADDR          0xB000000  // 176 MB
+#define MAX_SHM_ATTACH        4          // segments one process may attach
+#define FB_USER_ADDR          0xB000000  // 176 MB, graphics buffer from fbmap
+#define FB_USER_END           0xB400000  // 180 MB
+#define USER_END_ADDR         FB_USER_END  // end of everything a process may map
+
+// process states
+#define PROC_RUNNING          0          // on the CPU
+#define PROC_RUNNABLE         1          // waiting in the run queue
+#define PROC_WAIT_CHILD       2          // blocked in execute until its child halts
+#define PROC_SLEEPING         3          // blocked on a wait queue
+
+// multilevel feedback queue, level 0 runs first
+#define MLFQ_LEVELS           4          // number of priority levels
+#define MLFQ_BOOST_SLICES     50         // slices between priority boosts (~1s)
+
+#define PROC_NAME_LEN         33         // 32 character file name plus '\0'
+#define FPU_STATE_SIZE        512        // fxsave image
+#define FPU_AREA_SIZE         (FPU_STATE_SIZE + 16)  // room to align the image to 16 bytes
+
+
+
+// 16 processes max
 extern int process_flag[MAX_NUM_FILE];
 
 typedef struct{
@@ -51,9 +86,22 @@ typedef struct {
     int32_t in_use_flag;
 } file_descriptor_t;
 
-/* pcb structure */
+/* anonymous mapping [start, end) created by mmap */
 typedef struct {
-    uint32_t parent_ebp;
+    uint32_t start;
+    uint32_t end;
+} vm_area_t;
+
+/* shared memory segment attached at [start, end) */
+typedef struct {
+    int32_t id;
+    uint32_t start;
+    uint32_t end;
+} shm_attach_t;
+
+/* pcb structure */
+typedef struct pcb {
+    context_t context;                  // kernel registers saved by switch_to
     file_descriptor_t file_des[FILE_NUM];
     uint8_t arg_buf[KEYBOARD_BUFFER_SIZE];
     uint32_t terminal_id;
@@ -61,10 +109,40 @@ typedef struct {
     uint32_t parent_pid;
     uint32_t child_pid;
     uint32_t file_type;
-    uint32_t my_ebp;
+    uint32_t entry_pt;                  // user entry point of the program
+    uint32_t child_status;              // halt status of the last child
     uint8_t status_excep;
+    uint32_t user_pt[USER_PT_COUNT];    // physical addresses of user page tables, 0 if absent
+    uint32_t image_end;                 // end of the program image, stack may not grow below it
+    uint32_t heap_brk;                  // current program break
+    vm_area_t mmap_area[MAX_MMAP_AREAS];
+    shm_attach_t shm_attach[MAX_SHM_ATTACH];
+    uint32_t state;                     // PROC_RUNNING, PROC_RUNNABLE, ...
+    struct pcb* run_next;               // next process in the run queue or wait queue
+    uint32_t nice;                      // best level the process may reach
+    uint32_t level;                     // current mlfq level, nice..MLFQ_LEVELS-1
+    uint8_t name[PROC_NAME_LEN];        // program name
+    uint64_t user_cycles;               // tsc cycles spent in user mode
+    uint64_t kernel_cycles;             // tsc cycles spent in the kernel
+    uint32_t switches;                  // times switched off the cpu
+    uint32_t fpu_used;                  // fpu_area holds state saved from this process
+    uint8_t fpu_area[FPU_AREA_SIZE];    // fxsave image, see fpu_state()
 } __attribute__((packed)) pcb_t;
 
+/* process table entry returned by getprocs, same layout in user space */
+typedef struct {
+    uint32_t pid;
+    uint32_t parent_pid;
+    uint32_t terminal_id;
+    uint32_t state;
+    uint32_t nice;
+    uint32_t level;
+    uint32_t switches;
+    uint64_t user_cycles;
+    uint64_t kernel_cycles;
+    uint8_t name[PROC_NAME_LEN];
+} __attribute__((packed)) proc_info_t;
+
 /* open the file */
 int32_t open(const uint8_t* filename);
 
@@ -89,6 +167,15 @@ int32_t invalid_return();
 /* get current pcb */
 pcb_t* get_pcb();
 
+/* iret into the user program of the current process */
+void enter_user(uint32_t entry_pt);
+
+/* first code run by a new process */
+void user_start();
+
+/* undo a partially loaded program */
+void exec_fail(pcb_t* child_pcb, int pid);
+
 /* parse argument and command */
 int32_t parse_arg(const uint8_t* command, uint8_t* cmd_buf, uint8_t* arg_buf);
 
@@ -106,5 +193,23 @@ int32_t set_handler(int32_t signum, void* handler_address);
 /* signal return */
 int32_t sigreturn(void);
 
+/* grow or shrink the heap */
+int32_t sbrk(int32_t increment);
+
+/* create an anonymous demand-zero mapping */
+int32_t mmap(void* addr, uint32_t length);
+
+/* remove an anonymous mapping */
+int32_t munmap(void* addr, uint32_t length);
+
+/* change the scheduling priority of the calling process */
+int32_t nice(int32_t inc);
+
+/* copy a snapshot of the process table to user space */
+int32_t getprocs(proc_info_t* buf, int32_t count);
+
+/* change or query the mode of a terminal */
+int32_t ioctl(int32_t fd, int32_t request, int32_t arg);
+
 
 #endif
@@ -1,13 +1,16 @@
 #include "terminal.h"
 #include "lib.h"
 #include "system_calls.h"
+#include "schedule.h"
 
 
-// Initialize all terminal information to 0
-volatile int enter_count[TERMINAL_COUNT] = {0, 0, 0};
-volatile int tread_mode[TERMINAL_COUNT] = {0, 0, 0};
-volatile uint32_t key_buffer_index[TERMINAL_COUNT] = {0, 0, 0};
-volatile uint32_t term_buffer_index[TERMINAL_COUNT] = {0, 0, 0};
+// typed input of every terminal
+static ldisc_t ldisc[TERMINAL_COUNT];
+// processes blocked in tread, one queue per terminal
+static wait_queue_t tread_wait[TERMINAL_COUNT];
+// one reader at a time consumes a line from each terminal
+static mutex_t tread_mutex[TERMINAL_COUNT] = {MUTEX_UNLOCKED, MUTEX_UNLOCKED, MUTEX_UNLOCKED};
+spinlock_t console_lock = SPIN_LOCK_UNLOCKED;
 
 
 /* void terminal_init();
@@ -43,60 +46,204 @@ int32_t tclose(int32_t fd) {
     return DEFAULT_RET_VAL;
 }
 
+/* int32_t readable(ldisc_t* ld);
+ * Inputs: ld -- line discipline of the terminal
+ * Return Value: nonzero if a read would return data
+ * Function: In canonical mode a read waits for a whole line, in raw mode
+ *           for any character. The caller holds console_lock. */
+static int32_t readable(ldisc_t* ld) {
+    if (ld->mode & TERM_RAW)
+        return ld->head != ld->tail;
+    return ld->lines != 0;
+}
+
 /* void tread();
  * Inputs: fd -- file descriptor
            buf -- buffer that stores what is read from terminal buffer
            nbytes -- number of bytes to read
  * Return Value: number of characters read
- * Function: Read from the terminal buffer into buf */
+ * Function: Read typed input into buf. In canonical mode this is at most
+ *           one line including its '\n', in raw mode whatever was typed.
+ *           With TERM_NONBLOCK, 0 is returned when nothing is ready. */
 int32_t tread(int32_t fd, void* buf, int32_t nbytes) {
-    // Initialize the number of bytes read to 0
+    uint8_t chunk[TTY_BUF_SIZE];
     int count = 0;
-    int i;
-    tread_mode[cur_terminal] = 1; //use terminal buffer
-    // loop until it breaks
-    while(1) {
-      sti();
-        // if at least one Enter was pressed
-        if (enter_count[cur_terminal] != 0) {
-          while(terminal_buffer[cur_terminal][count] != '\n' && count < nbytes) {
-              *((uint8_t*)buf + count) = terminal_buffer[cur_terminal][count];
-              count++;
-          }
-
-          if (terminal_buffer[cur_terminal][count] == '\n') {
-              *((uint8_t*)buf + count) = '\n';
-              count++;
-          }
-
-          // erase terminal buffer for the first to the last terminal
-          for (i = 0; i < KEYBOARD_BUFFER_SIZE; i++) {
-              terminal_buffer[cur_terminal][i] = NULL;
-          }
-
-          term_buffer_index[cur_terminal] = 0;  // reset buffer index to initial value
-          enter_count[cur_terminal] = 0;
-          break;
+    uint32_t flags;
+    uint8_t c;
+    uint8_t term = get_pcb()->terminal_id;
+    ldisc_t* ld = &ldisc[term];
+
+    if (nbytes > TTY_BUF_SIZE)
+        nbytes = TTY_BUF_SIZE;
+    mutex_lock(&tread_mutex[term]);
+    spin_lock_irqsave(&console_lock, flags);
+    while (!readable(ld)) {
+        if (ld->mode & TERM_NONBLOCK)
+            break;
+        sleep_on_lock(&tread_wait[term], &console_lock);
+    }
+
+    while (count < nbytes && ld->head != ld->tail) {
+        c = ld->ready[ld->head % TTY_BUF_SIZE];
+        ld->head++;
+        chunk[count++] = c;
+        if (c == '\n' && !(ld->mode & TERM_RAW)) {
+            ld->lines--;
+            break;
         }
-     }
-    tread_mode[cur_terminal] = 0;     // reset tread_mode for current terminal to initial value
-    cli();
+    }
+    spin_unlock_irqrestore(&console_lock, flags);
+    mutex_unlock(&tread_mutex[term]);
+    // copy after unlocking so a fault on the user buffer is not taken under the lock
+    memcpy(buf, chunk, count);
     return count;
 }
 
+/* void ldisc_queue(uint8_t term, uint8_t c);
+ * Inputs: term -- terminal
+ *         c -- character to hand to readers
+ * Return Value: None
+ * Function: Append to the ready ring, dropping c if the reader is too far
+ *           behind. The caller holds console_lock. */
+static void ldisc_queue(uint8_t term, uint8_t c) {
+    ldisc_t* ld = &ldisc[term];
+    if (ld->tail - ld->head >= TTY_BUF_SIZE)
+        return;
+    ld->ready[ld->tail % TTY_BUF_SIZE] = c;
+    ld->tail++;
+}
+
+/* void tread_wake();
+ * Inputs: term -- terminal that has input ready
+ * Return Value: None
+ * Function: Wake the processes blocked in tread on term, they are
+ *           interactive so they jump ahead of cpu-bound processes.
+ *           Called with console_lock held. */
+static void tread_wake(uint8_t term) {
+    uint32_t flags;
+    // the run queue is shared with interrupt handlers
+    cli_and_save(flags);
+    wake_up_interactive(&tread_wait[term]);
+    restore_flags(flags);
+}
+
+/* void ldisc_input(uint8_t term, uint8_t c);
+ * Inputs: term -- terminal the key was typed on, the screen terminal
+ *         c -- decoded key, '\n' for Enter and '\b' for Backspace
+ * Return Value: None
+ * Function: In raw mode pass the key straight to readers. In canonical
+ *           mode edit and echo the current line and hand it over on
+ *           Enter. The caller holds console_lock. */
+void ldisc_input(uint8_t term, uint8_t c) {
+    ldisc_t* ld = &ldisc[term];
+    uint32_t i;
+
+    if (ld->mode & TERM_RAW) {
+        ldisc_queue(term, c);
+        tread_wake(term);
+        return;
+    }
+    switch (c) {
+        case '\b':
+            if (ld->line_len > 0) {
+                remove_char(ld->line_len);
+                ld->line_len--;
+            }
+            break;
+
+        case '\n':
+            // a line that does not fit is dropped whole
+            if (ld->tail - ld->head + ld->line_len + 1 <= TTY_BUF_SIZE) {
+                for (i = 0; i < ld->line_len; i++)
+                    ldisc_queue(term, ld->line[i]);
+                ldisc_queue(term, '\n');
+                ld->lines++;
+            }
+            ld->line_len = 0;
+            enter_lib(term);
+            tread_wake(term);
+            break;
+
+        default:
+            // keep room for the '\n'
+            if (ld->line_len < KEYBOARD_BUFFER_SIZE - 1) {
+                ld->line[ld->line_len++] = c;
+                putkey(c, term);
+            }
+            break;
+    }
+}
+
+/* void ldisc_flush(uint8_t term);
+ * Inputs: term -- terminal
+ * Return Value: None
+ * Function: Forget typed input and the mode a program set, so the next
+ *           program starts clean. The caller holds console_lock. */
+void ldisc_flush(uint8_t term) {
+    ldisc_t* ld = &ldisc[term];
+    ld->head = ld->tail = 0;
+    ld->lines = 0;
+    ld->line_len = 0;
+    ld->mode = 0;
+}
+
+/* int32_t terminal_ioctl(uint8_t term, int32_t request, int32_t arg);
+ * Inputs: term -- terminal of the calling process
+ *         request -- TERM_GETMODE or TERM_SETMODE
+ *         arg -- new mode flags for TERM_SETMODE
+ * Return Value: the mode flags for TERM_GETMODE, 0 on success for
+ *               TERM_SETMODE, -1 for a bad request or flags
+ * Function: Switch a terminal between canonical and raw input and between
+ *           blocking and non-blocking reads */
+int32_t terminal_ioctl(uint8_t term, int32_t request, int32_t arg) {
+    ldisc_t* ld = &ldisc[term];
+    uint32_t flags;
+    uint32_t i;
+
+    if (term >= TERMINAL_COUNT)
+        return -1;
+    if (request == TERM_GETMODE)
+        return ld->mode;
+    if (request != TERM_SETMODE || (arg & ~TERM_MODE_MASK) != 0)
+        return -1;
+
+    spin_lock_irqsave(&console_lock, flags);
+    if ((ld->mode & TERM_RAW) && !(arg & TERM_RAW)) {
+        // raw input has no line structure, count what becomes a line
+        ld->lines = 0;
+        for (i = ld->head; i != ld->tail; i++) {
+            if (ld->ready[i % TTY_BUF_SIZE] == '\n')
+                ld->lines++;
+        }
+    }
+    else if (!(ld->mode & TERM_RAW) && (arg & TERM_RAW)) {
+        // the half typed line becomes input
+        for (i = 0; i < ld->line_len; i++)
+            ldisc_queue(term, ld->line[i]);
+        ld->line_len = 0;
+    }
+    ld->mode = arg;
+    // a reader asleep under the old mode may have something to read now
+    tread_wake(term);
+    spin_unlock_irqrestore(&console_lock, flags);
+    return 0;
+}
+
 /* void putc_to_screen();
  * Inputs: c -- character to put to the screen
  * Return Value: None
  * Function: Read from the terminal buffer into buf */
 void putc_to_screen(const char c) {
-  cli();
-  // if enter was pressed, handle enter and return
+  uint32_t flags;
   pcb_t* temp = get_pcb();
-    if (c == '\n') {
+  // interrupts are only off for one character at a time
+  spin_lock_irqsave(&console_lock, flags);
+  // if enter was pressed, handle enter
+    if (c == '\n')
         enter_lib(temp->terminal_id);
-        return;
-    }
-    putkey(c, temp->terminal_id);
+    else
+        putkey(c, temp->terminal_id);
+  spin_unlock_irqrestore(&console_lock, flags);
 }
 
 
@@ -105,17 +252,27 @@ void putc_to_screen(const char c) {
            buf -- buffer that stores what to write to the screen
            nbytes -- number of bytes to write
  * Return Value: number of characters/bytes written or -1
- * Function: Write from buf to the screen */
+ * Function: Write from buf to the screen, one chunk per lock hold */
 int32_t twrite(int32_t fd, const void* buf, int32_t nbytes) {
+    uint8_t chunk[TWRITE_CHUNK];
+    uint32_t flags;
+    uint8_t term = get_pcb()->terminal_id;
     // Initialize number of bytes written to 0
-    int count = 0;
+    int count = 0, len;
     // if buf is NULL, return -1 to indicate fail
     if (buf == NULL)
         return -1;
     // while count is smaller than nbytes
     while (count < nbytes) {
-        putc_to_screen(*((uint8_t*)buf + count));
-        count++;
+        len = nbytes - count;
+        if (len > TWRITE_CHUNK)
+            len = TWRITE_CHUNK;
+        // copy first so a fault on the user buffer is not taken under the lock
+        memcpy(chunk, (uint8_t*)buf + count, len);
+        spin_lock_irqsave(&console_lock, flags);
+        putbuf(chunk, len, term);
+        spin_unlock_irqrestore(&console_lock, flags);
+        count += len;
     }
     return count;
 }
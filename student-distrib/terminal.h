@@ -1,23 +1,41 @@
 #ifndef _TERMINAL_H
 #define _TERMINAL_H
 #include "types.h"
+#include "lock.h"
 
 
 #define DEFAULT_RET_VAL   0
 #define TERMINAL_COUNT    3
 #define KEYBOARD_BUFFER_SIZE  128
+#define TWRITE_CHUNK      512   // bytes rendered per console_lock hold
+#define TERM_VIDEO_SIZE   0x2000  // bytes of VGA text memory owned by each terminal
+#define TTY_BUF_SIZE      256     // characters typed ahead of the reader, a power of two
+
+// ioctl requests and mode flags of a terminal
+#define TERM_GETMODE      0       // return the mode flags
+#define TERM_SETMODE      1       // replace the mode flags with arg
+#define TERM_RAW          0x1     // hand every key to read at once, no editing or echo
+#define TERM_NONBLOCK     0x2     // read returns 0 instead of sleeping when nothing is typed
+#define TERM_MODE_MASK    (TERM_RAW | TERM_NONBLOCK)
 
-//terminal buffer for terminal read and write
-volatile uint8_t terminal_buffer[TERMINAL_COUNT][KEYBOARD_BUFFER_SIZE];
 volatile uint8_t cur_terminal;
 volatile uint8_t screen_terminal;
 volatile uint8_t prev_screen_terminal;
 
-// arrays for important info for three terminals
-extern volatile int enter_count[TERMINAL_COUNT];
-extern volatile int tread_mode[TERMINAL_COUNT] ;
-extern volatile uint32_t key_buffer_index[TERMINAL_COUNT] ;
-extern volatile uint32_t term_buffer_index[TERMINAL_COUNT];
+// protects the screens, cursor state and keyboard/terminal buffers. Like
+// every spinlock it is only held with interrupts off; printf and puts take it
+extern spinlock_t console_lock;
+
+// line discipline of a terminal, protected by console_lock
+typedef struct {
+    uint8_t ready[TTY_BUF_SIZE];        // ring of characters read may return
+    uint32_t head;                      // next character to read, free running
+    uint32_t tail;                      // next free slot, free running
+    uint32_t lines;                     // complete lines in ready, canonical mode
+    uint8_t line[KEYBOARD_BUFFER_SIZE]; // line being edited, canonical mode
+    uint32_t line_len;
+    uint32_t mode;                      // TERM_RAW | TERM_NONBLOCK
+} ldisc_t;
 
 // terminal struct
 typedef struct {
@@ -40,6 +58,12 @@ extern int32_t tclose(int32_t fd);
 extern int32_t tread(int32_t fd, void* buf, int32_t nbytes);
 /* function to write from buf to the screen */
 extern int32_t twrite(int32_t fd, const void* buf, int32_t nbytes);
+/* function to change or query the mode of a terminal */
+extern int32_t terminal_ioctl(uint8_t term, int32_t request, int32_t arg);
+/* function to feed a typed character through the line discipline */
+extern void ldisc_input(uint8_t term, uint8_t c);
+/* function to drop typed input and go back to canonical mode */
+extern void ldisc_flush(uint8_t term);
 /* function to put a character to the screen */
 extern void putc_to_screen(const char c);
 
@@ -11,6 +11,8 @@
 #include "types.h"
 #include "keyboard.h"
 #include "terminal.h"
+#include "schedule.h"
+#include "switch.h"
 
 
 #define PASS 1
@@ -481,6 +483,60 @@ int terminal_write_test_long() {// shorter than buffer size
 /* Checkpoint 4 tests */
 /* Checkpoint 5 tests */
 
+#define SWITCH_BENCH_ROUNDS	10000
+#define BENCH_STACK_WORDS	256
+
+static context_t bench_main_ctx, bench_peer_ctx;
+static uint32_t bench_peer_stack[BENCH_STACK_WORDS];
+static volatile uint32_t bench_bounces;
+
+/* switch_bench_peer
+ *
+ * Peer side of switch_bench_test, switches straight back every time
+ */
+static void switch_bench_peer(){
+	while (1) {
+		bench_bounces++;
+		switch_to(&bench_peer_ctx, &bench_main_ctx);
+	}
+}
+
+/* switch_to benchmark
+ *
+ * Bounces between two kernel stacks and prints the average cycles of one
+ * round trip (two switch_to calls), so regressions in the switch path show
+ * up at boot. Does not include the page directory reload of context_switch.
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None
+ * Coverage: switch_to
+ * Files: switch.S/h
+ */
+int switch_bench_test(){
+	TEST_HEADER;
+	uint32_t flags, cycles;
+	uint64_t start;
+	int i;
+
+	bench_bounces = 0;
+	bench_peer_ctx.esp = (uint32_t)&bench_peer_stack[BENCH_STACK_WORDS - 1];
+	bench_peer_ctx.ebp = 0;
+	bench_peer_ctx.eip = (uint32_t)switch_bench_peer;
+	// nothing may run on the peer's stack
+	cli_and_save(flags);
+	// the first round starts the peer and warms the caches
+	switch_to(&bench_main_ctx, &bench_peer_ctx);
+	start = rdtsc();
+	for (i = 0; i < SWITCH_BENCH_ROUNDS; i++)
+		switch_to(&bench_main_ctx, &bench_peer_ctx);
+	// fits in 32 bits, and the kernel has no 64-bit divide
+	cycles = (uint32_t)(rdtsc() - start);
+	restore_flags(flags);
+
+	printf("switch_to round trip: %d cycles\n", cycles / SWITCH_BENCH_ROUNDS);
+	return (bench_bounces == SWITCH_BENCH_ROUNDS + 1) ? PASS : FAIL;
+}
+
 
 /* Test suite entry point */
 void launch_tests(){
@@ -497,4 +553,5 @@ void launch_tests(){
   // TEST_OUTPUT("terminal_read_write_test", terminal_read_write_test());
   // TEST_OUTPUT("terminal_write_test_short", terminal_write_test_short());
   // TEST_OUTPUT("terminal_write_test_long", terminal_write_test_long());
+	TEST_OUTPUT("switch_bench_test", switch_bench_test());
 }
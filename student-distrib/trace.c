@@ -0,0 +1,98 @@
+#include "trace.h"
+#include "lib.h"
+#include "schedule.h"
+#include "system_calls.h"
+
+/* recorded events. Writers have interrupts off, so the ring needs no
+ * lock; the oldest events are overwritten when it is full */
+typedef struct {
+    volatile uint32_t head;             // total events written
+    uint32_t tail;                      // first event gettrace has not returned
+    trace_event_t events[TRACE_RING_SIZE];
+} trace_ring_t;
+
+static trace_ring_t trace_ring;
+
+/*
+ * void trace_event(uint32_t type, uint32_t arg);
+ * Inputs: uint32_t type -- TRACE_* event type
+ *         uint32_t arg -- event argument, see trace.h
+ * Return Value: None
+ * Function: stamp an event with the tsc and current pid and append it to
+ *           the ring
+ */
+void trace_event(uint32_t type, uint32_t arg) {
+    uint32_t flags;
+    trace_ring_t* ring = &trace_ring;
+    trace_event_t* ev;
+
+    cli_and_save(flags);
+    ev = &ring->events[ring->head & TRACE_RING_MASK];
+    ev->tsc = rdtsc();
+    ev->type = type;
+    // processes only run on one cpu
+    ev->cpu = 0;
+    ev->pid = get_pcb()->pid;
+    ev->arg = arg;
+    ring->head++;
+    restore_flags(flags);
+}
+
+/*
+ * void trace_irq_enter(uint32_t irq);
+ * Inputs: uint32_t irq -- irq line of the interrupt
+ * Return Value: None
+ * Function: record the start of an interrupt handler
+ */
+void trace_irq_enter(uint32_t irq) {
+    trace_event(TRACE_IRQ_ENTER, irq);
+}
+
+/*
+ * void trace_irq_exit(uint32_t irq);
+ * Inputs: uint32_t irq -- irq line of the interrupt
+ * Return Value: None
+ * Function: record the end of an interrupt, after its bottom halves
+ */
+void trace_irq_exit(uint32_t irq) {
+    trace_event(TRACE_IRQ_EXIT, irq);
+}
+
+/*
+ * int32_t gettrace(trace_event_t* buf, int32_t count);
+ * Inputs: trace_event_t* buf -- user buffer for the events
+ *         int32_t count -- number of events buf can hold
+ * Return Value: number of events written, -1 if buf is invalid
+ * Function: stream the events recorded since the last call, oldest
+ *           first. Events overwritten in the meantime are skipped.
+ */
+int32_t gettrace(trace_event_t* buf, int32_t count) {
+    uint32_t flags;
+    int32_t n = 0;
+    trace_ring_t* ring = &trace_ring;
+    trace_event_t ev;
+
+    if (buf == NULL || count <= 0)
+        return -1;
+    // bound count before multiplying so a huge count cannot wrap the sum
+    if ((uint32_t)count > (USER_END_ADDR - VM_START_ADDR) / sizeof(trace_event_t) ||
+        (uint32_t)buf < VM_START_ADDR || (uint32_t)buf > USER_END_ADDR ||
+        count * sizeof(trace_event_t) > USER_END_ADDR - (uint32_t)buf)
+        return -1;
+
+    while (n < count) {
+        // copy out of the ring first, the user buffer may fault
+        cli_and_save(flags);
+        if (ring->head - ring->tail > TRACE_RING_SIZE)
+            ring->tail = ring->head - TRACE_RING_SIZE;
+        if (ring->tail == ring->head) {
+            restore_flags(flags);
+            break;
+        }
+        ev = ring->events[ring->tail & TRACE_RING_MASK];
+        ring->tail++;
+        restore_flags(flags);
+        buf[n++] = ev;
+    }
+    return n;
+}
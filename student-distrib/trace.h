@@ -0,0 +1,37 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "types.h"
+
+#define TRACE_RING_SIZE     1024        // events kept, a power of two
+#define TRACE_RING_MASK     (TRACE_RING_SIZE - 1)
+
+// event types, arg holds the value noted after each
+#define TRACE_SWITCH        0           // pid of the process switched to
+#define TRACE_WAKE          1           // pid of the woken process
+#define TRACE_BLOCK         2           // 0
+#define TRACE_EXEC          3           // pid of the new process
+#define TRACE_EXIT          4           // halt status
+#define TRACE_IRQ_ENTER     5           // irq number
+#define TRACE_IRQ_EXIT      6           // irq number
+#define TRACE_PREEMPT       7           // mlfq level after the slice ran out
+
+/* one scheduler event, same layout in user space */
+typedef struct {
+    uint64_t tsc;                       // time stamp counter when recorded
+    uint8_t type;                       // TRACE_*
+    uint8_t cpu;                        // always 0, processes run on one cpu
+    uint16_t pid;                       // process running at the time
+    uint32_t arg;
+} __attribute__((packed)) trace_event_t;
+
+/* Record an event in the trace ring */
+void trace_event(uint32_t type, uint32_t arg);
+/* Record interrupt entry, called by the irq linkage */
+void trace_irq_enter(uint32_t irq);
+/* Record interrupt exit, called by the irq linkage */
+void trace_irq_exit(uint32_t irq);
+/* Copy the events not read yet to user space */
+int32_t gettrace(trace_event_t* buf, int32_t count);
+
+#endif
@@ -102,3 +102,120 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+
+/*
+ * Heap allocator.  Small blocks come from an arena grown with sbrk and are
+ * kept on an address-ordered free list so neighbours coalesce on free.
+ * Large blocks get their own anonymous mapping and are unmapped on free.
+ * Pages are demand-zero, so growing the arena costs nothing until touched.
+ */
+#define MALLOC_ALIGN      8
+#define ARENA_CHUNK       0x4000      /* grow the arena 16KB at a time */
+#define MMAP_THRESHOLD    0x10000     /* blocks of 64KB or more get a mapping */
+#define PAGE_SIZE         0x1000
+#define BLOCK_MMAP        0x1         /* size low bit: block came from mmap */
+#define BLOCK_SIZE(b)     ((b)->size & ~(MALLOC_ALIGN - 1))
+
+typedef struct block_hdr {
+    uint32_t size;               /* block size including header, plus flags */
+    struct block_hdr* next;      /* next free block, only valid while free */
+} block_hdr_t;
+
+#define MIN_BLOCK         (sizeof(block_hdr_t) + MALLOC_ALIGN)
+
+static block_hdr_t* free_list = 0;
+
+/* Insert a block into the free list, merging it with adjacent free blocks */
+static void
+free_list_insert(block_hdr_t* blk)
+{
+    block_hdr_t* prev = 0;
+    block_hdr_t* cur = free_list;
+
+    while (cur != 0 && cur < blk) {
+        prev = cur;
+        cur = cur->next;
+    }
+
+    blk->next = cur;
+    if (cur != 0 && (uint8_t*)blk + BLOCK_SIZE(blk) == (uint8_t*)cur) {
+        blk->size += BLOCK_SIZE(cur);
+        blk->next = cur->next;
+    }
+
+    if (prev == 0) {
+        free_list = blk;
+    } else if ((uint8_t*)prev + BLOCK_SIZE(prev) == (uint8_t*)blk) {
+        prev->size += BLOCK_SIZE(blk);
+        prev->next = blk->next;
+    } else {
+        prev->next = blk;
+    }
+}
+
+/* Allocate size bytes, or return 0 if no memory is left */
+void* ece391_malloc(uint32_t size)
+{
+    block_hdr_t* prev = 0;
+    block_hdr_t* cur;
+    block_hdr_t* rest;
+    uint32_t need, grow;
+    int32_t addr;
+
+    if (size == 0 || size > MMAP_THRESHOLD * 1024)
+        return 0;
+    need = (size + sizeof(block_hdr_t) + MALLOC_ALIGN - 1) & ~(MALLOC_ALIGN - 1);
+
+    if (need >= MMAP_THRESHOLD) {
+        need = (need + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        if (-1 == (addr = ece391_mmap(0, need)))
+            return 0;
+        cur = (block_hdr_t*)addr;
+        cur->size = need | BLOCK_MMAP;
+        return cur + 1;
+    }
+
+    while (1) {
+        /* first fit */
+        for (cur = free_list; cur != 0; prev = cur, cur = cur->next) {
+            if (BLOCK_SIZE(cur) < need)
+                continue;
+            if (BLOCK_SIZE(cur) - need >= MIN_BLOCK) {
+                rest = (block_hdr_t*)((uint8_t*)cur + need);
+                rest->size = BLOCK_SIZE(cur) - need;
+                rest->next = cur->next;
+                cur->size = need;
+                cur->next = rest;
+            }
+            if (prev == 0)
+                free_list = cur->next;
+            else
+                prev->next = cur->next;
+            return cur + 1;
+        }
+
+        /* nothing fits, grow the arena and retry */
+        grow = (need > ARENA_CHUNK) ? need : ARENA_CHUNK;
+        if (-1 == (addr = ece391_sbrk(grow)))
+            return 0;
+        cur = (block_hdr_t*)addr;
+        cur->size = grow;
+        free_list_insert(cur);
+        prev = 0;
+    }
+}
+
+/* Release a block returned by ece391_malloc */
+void ece391_free(void* ptr)
+{
+    block_hdr_t* blk;
+
+    if (ptr == 0)
+        return;
+    blk = (block_hdr_t*)ptr - 1;
+    if (blk->size & BLOCK_MMAP) {
+        (void)ece391_munmap(blk, BLOCK_SIZE(blk));
+        return;
+    }
+    free_list_insert(blk);
+}
@@ -22,6 +22,109 @@ extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
 
+/*
+ * sbrk returns the previous program break; mmap returns the start of a new
+ * anonymous mapping (addr may be NULL to let the kernel choose).  Heap and
+ * mapped pages are zero-filled on first touch.
+ */
+extern int32_t ece391_sbrk (int32_t increment);
+extern int32_t ece391_mmap (void* addr, uint32_t length);
+extern int32_t ece391_munmap (void* addr, uint32_t length);
+
+/*
+ * Shared memory: shmget returns the id of the segment for a nonzero key,
+ * creating it if needed; shmat maps it at addr (or a kernel-chosen address
+ * if addr is NULL) and returns that address.  Every process attached to a
+ * segment sees the same pages.
+ */
+extern int32_t ece391_shmget (int32_t key, uint32_t size);
+extern int32_t ece391_shmat (int32_t id, void* addr);
+extern int32_t ece391_shmdt (void* addr);
+
+/*
+ * nice adds inc to the calling process's nice value (0 = highest priority,
+ * 3 = lowest) and returns the new value.  Children inherit it.
+ */
+extern int32_t ece391_nice (int32_t inc);
+
+/*
+ * getprocs fills buf with up to count process table entries (the idle task
+ * comes last) and returns how many were written.  Cycle counts are raw TSC
+ * cycles since the process started.
+ */
+#define PROC_NAME_LEN 33
+typedef struct {
+    uint32_t pid;
+    uint32_t parent_pid;
+    uint32_t terminal_id;
+    uint32_t state;             /* 0 running, 1 runnable, 2 waiting for child, 3 sleeping */
+    uint32_t nice;
+    uint32_t level;
+    uint32_t switches;
+    uint64_t user_cycles;
+    uint64_t kernel_cycles;
+    uint8_t name[PROC_NAME_LEN];
+} __attribute__((packed)) proc_info_t;
+
+extern int32_t ece391_getprocs (proc_info_t* buf, int32_t count);
+
+/*
+ * gettrace fills buf with up to count scheduler events recorded since the
+ * previous call and returns how many were written.  Each cpu keeps the
+ * last 1024 events; older ones are lost if nobody reads them in time.
+ */
+#define TRACE_SWITCH    0       /* arg: pid switched to */
+#define TRACE_WAKE      1       /* arg: pid woken */
+#define TRACE_BLOCK     2
+#define TRACE_EXEC      3       /* arg: pid of the new process */
+#define TRACE_EXIT      4       /* arg: halt status */
+#define TRACE_IRQ_ENTER 5       /* arg: irq number */
+#define TRACE_IRQ_EXIT  6       /* arg: irq number */
+#define TRACE_PREEMPT   7       /* arg: mlfq level after the slice */
+typedef struct {
+    uint64_t tsc;
+    uint8_t type;
+    uint8_t cpu;
+    uint16_t pid;
+    uint32_t arg;
+} __attribute__((packed)) trace_event_t;
+
+extern int32_t ece391_gettrace (trace_event_t* buf, int32_t count);
+
+/*
+ * ioctl on stdin or stdout changes how the terminal delivers keys.  By
+ * default a read returns one edited line once Enter is pressed.  In raw
+ * mode keys are not echoed and a read returns whatever was typed; with
+ * TERM_NONBLOCK a read returns 0 instead of waiting.  TERM_GETMODE returns
+ * the current flags.  The mode is reset when the program halts.
+ */
+#define TERM_GETMODE    0
+#define TERM_SETMODE    1       /* arg: new flags */
+#define TERM_RAW        0x1
+#define TERM_NONBLOCK   0x2
+
+extern int32_t ece391_ioctl (int32_t fd, int32_t request, int32_t arg);
+
+/*
+ * When the kernel runs with a framebuffer ("vbe" on its command line),
+ * fbmap gives the program a FB_WIDTH x FB_HEIGHT buffer of 0x00RRGGBB
+ * pixels and stores its address in *buf.  Its terminal shows the buffer
+ * instead of text until the program halts.  Drawing is not visible until
+ * fbflip copies the buffer, or the rectangle rect of it (NULL for all),
+ * to the screen.
+ */
+#define FB_WIDTH        640
+#define FB_HEIGHT       400
+typedef struct {
+    int32_t x;
+    int32_t y;
+    int32_t w;
+    int32_t h;
+} fb_rect_t;
+
+extern int32_t ece391_fbmap (uint8_t** buf);
+extern int32_t ece391_fbflip (const fb_rect_t* rect);
+
 enum signums {
 	DIV_ZERO = 0,
 	SEGFAULT,
@@ -0,0 +1,119 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define MAX_PROCS       17      /* 16 processes plus the idle task */
+#define BUFSIZE         128
+#define DEFAULT_ROUNDS  10
+#define RTC_FREQ        2       /* two RTC reads per refresh = one second */
+#define CYCLE_SHIFT     10      /* work in units of 1024 cycles to stay in 32 bits */
+
+static proc_info_t prev[MAX_PROCS];
+static proc_info_t cur[MAX_PROCS];
+static const char* state_name[] = {"run", "ready", "wait", "sleep"};
+
+/* Print s left aligned in a column of the given width. */
+static void
+put_col (const uint8_t* s, uint32_t width)
+{
+    uint32_t len = ece391_strlen (s);
+
+    ece391_fdputs (1, s);
+    while (len++ < width)
+        ece391_fdputs (1, (uint8_t*)" ");
+}
+
+/* Print a number left aligned in a column of the given width. */
+static void
+put_num (uint32_t value, uint32_t width)
+{
+    uint8_t buf[BUFSIZE];
+
+    ece391_itoa (value, buf, 10);
+    put_col (buf, width);
+}
+
+/* Cycles a process used since the previous snapshot, in 1024-cycle units. */
+static uint32_t
+delta (const proc_info_t* p, uint64_t cycles, int32_t user, int32_t nprev)
+{
+    int32_t i;
+    uint64_t before = 0;
+
+    for (i = 0; i < nprev; i++) {
+        if (prev[i].pid == p->pid && 0 == ece391_strcmp (prev[i].name, p->name)) {
+            before = user ? prev[i].user_cycles : prev[i].kernel_cycles;
+            break;
+        }
+    }
+    return (uint32_t)((cycles - before) >> CYCLE_SHIFT);
+}
+
+int main ()
+{
+    uint8_t buf[BUFSIZE];
+    int32_t rtc_fd, freq = RTC_FREQ;
+    int32_t rounds = DEFAULT_ROUNDS, round, i, n, nprev = 0, garbage;
+    uint32_t total, d_user, d_kernel;
+
+    /* optional argument: number of refreshes */
+    if (0 == ece391_getargs (buf, BUFSIZE) && buf[0] != '\0') {
+        rounds = 0;
+        for (i = 0; buf[i] >= '0' && buf[i] <= '9'; i++)
+            rounds = rounds * 10 + (buf[i] - '0');
+        if (rounds <= 0 || buf[i] != '\0') {
+            ece391_fdputs (1, (uint8_t*)"usage: top [refreshes]\n");
+            return 3;
+        }
+    }
+
+    if (-1 == (rtc_fd = ece391_open ((uint8_t*)"rtc"))) {
+        ece391_fdputs (1, (uint8_t*)"rtc open failed\n");
+        return 2;
+    }
+    ece391_write (rtc_fd, &freq, 4);
+
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < RTC_FREQ; i++)
+            ece391_read (rtc_fd, &garbage, 4);
+
+        if (-1 == (n = ece391_getprocs (cur, MAX_PROCS))) {
+            ece391_fdputs (1, (uint8_t*)"getprocs failed\n");
+            return 3;
+        }
+
+        /* every cycle of the last second went to exactly one process */
+        total = 0;
+        for (i = 0; i < n; i++) {
+            total += delta (&cur[i], cur[i].user_cycles, 1, nprev);
+            total += delta (&cur[i], cur[i].kernel_cycles, 0, nprev);
+        }
+        if (total == 0)
+            total = 1;
+
+        ece391_fdputs (1, (uint8_t*)"\nPID TERM NI LV STATE %USR %SYS SWITCHES NAME\n");
+        for (i = 0; i < n; i++) {
+            d_user = delta (&cur[i], cur[i].user_cycles, 1, nprev);
+            d_kernel = delta (&cur[i], cur[i].kernel_cycles, 0, nprev);
+            put_num (cur[i].pid, 4);
+            put_num (cur[i].terminal_id, 5);
+            put_num (cur[i].nice, 3);
+            put_num (cur[i].level, 3);
+            put_col ((uint8_t*)(cur[i].state < 4 ? state_name[cur[i].state] : "?"), 6);
+            put_num (d_user * 100 / total, 5);
+            put_num (d_kernel * 100 / total, 5);
+            put_num (cur[i].switches, 9);
+            ece391_fdputs (1, cur[i].name);
+            ece391_fdputs (1, (uint8_t*)"\n");
+        }
+
+        /* byte copy, there is no memcpy to fall back on */
+        for (i = 0; i < n * (int32_t)sizeof (proc_info_t); i++)
+            ((uint8_t*)prev)[i] = ((uint8_t*)cur)[i];
+        nprev = n;
+    }
+
+    ece391_close (rtc_fd);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BATCH           64
+#define BUFSIZE         128
+#define RTC_FREQ        2       /* two RTC reads per second */
+#define NUM_TYPES       8
+
+static trace_event_t events[BATCH];
+static const char* type_name[NUM_TYPES] = {
+    "switch", "wake", "block", "exec", "exit", "irq_enter", "irq_exit", "preempt"
+};
+
+/* Print value as exactly eight hex digits. */
+static void
+put_hex (uint32_t value)
+{
+    uint8_t buf[9];
+    int32_t i;
+
+    for (i = 7; i >= 0; i--) {
+        buf[i] = "0123456789abcdef"[value & 0xF];
+        value >>= 4;
+    }
+    buf[8] = '\0';
+    ece391_fdputs (1, buf);
+}
+
+/* Print a decimal number followed by the separator string. */
+static void
+put_num (uint32_t value, const char* sep)
+{
+    uint8_t buf[BUFSIZE];
+
+    ece391_itoa (value, buf, 10);
+    ece391_fdputs (1, buf);
+    ece391_fdputs (1, (uint8_t*)sep);
+}
+
+/*
+ * Print every event the kernel has buffered, one per line:
+ *     T <cpu> <tsc, 16 hex digits> <type> <pid> <arg>
+ * trace2json.py turns these lines into a Chrome trace.
+ */
+static int32_t
+drain (void)
+{
+    int32_t i, n;
+    const trace_event_t* ev;
+
+    do {
+        if (-1 == (n = ece391_gettrace (events, BATCH))) {
+            ece391_fdputs (1, (uint8_t*)"gettrace failed\n");
+            return -1;
+        }
+        for (i = 0; i < n; i++) {
+            ev = &events[i];
+            ece391_fdputs (1, (uint8_t*)"T ");
+            put_num (ev->cpu, " ");
+            put_hex ((uint32_t)(ev->tsc >> 32));
+            put_hex ((uint32_t)ev->tsc);
+            ece391_fdputs (1, (uint8_t*)" ");
+            ece391_fdputs (1, (uint8_t*)(ev->type < NUM_TYPES ? type_name[ev->type] : "?"));
+            ece391_fdputs (1, (uint8_t*)" ");
+            put_num (ev->pid, " ");
+            put_num (ev->arg, "\n");
+        }
+    } while (n == BATCH);
+    return 0;
+}
+
+int main ()
+{
+    uint8_t buf[BUFSIZE];
+    int32_t rtc_fd, freq = RTC_FREQ;
+    int32_t seconds = 0, i, j, garbage;
+
+    /* optional argument: keep streaming for this many seconds */
+    if (0 == ece391_getargs (buf, BUFSIZE) && buf[0] != '\0') {
+        for (i = 0; buf[i] >= '0' && buf[i] <= '9'; i++)
+            seconds = seconds * 10 + (buf[i] - '0');
+        if (seconds <= 0 || buf[i] != '\0') {
+            ece391_fdputs (1, (uint8_t*)"usage: trace [seconds]\n");
+            return 3;
+        }
+    }
+
+    if (-1 == drain ())
+        return 3;
+    if (seconds == 0)
+        return 0;
+
+    if (-1 == (rtc_fd = ece391_open ((uint8_t*)"rtc"))) {
+        ece391_fdputs (1, (uint8_t*)"rtc open failed\n");
+        return 2;
+    }
+    ece391_write (rtc_fd, &freq, 4);
+    for (i = 0; i < seconds; i++) {
+        for (j = 0; j < RTC_FREQ; j++)
+            ece391_read (rtc_fd, &garbage, 4);
+        if (-1 == drain ())
+            return 3;
+    }
+    ece391_close (rtc_fd);
+    return 0;
+}
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""Convert the output of the `trace` program into Chrome trace JSON.
+
+Capture the lines `trace` prints (from the screen or a serial log), then
+
+    ./trace2json.py --mhz 2400 trace.txt > trace.json
+
+and open trace.json in chrome://tracing or https://ui.perfetto.dev.
+Every cpu is shown as a process. Each kernel pid gets a track showing
+when it was running, and interrupts get one track per irq line.
+"""
+
+import argparse
+import json
+import sys
+
+IDLE_PID = 16
+IRQ_TID_BASE = 1000
+IRQ_NAMES = {0: "pit", 1: "keyboard", 4: "serial", 8: "rtc"}
+
+
+def parse(lines):
+    """Yield (cpu, tsc, type, pid, arg) for every trace line."""
+    for line in lines:
+        fields = line.split()
+        if len(fields) != 6 or fields[0] != "T":
+            continue
+        try:
+            yield (int(fields[1]), int(fields[2], 16), fields[3],
+                   int(fields[4]), int(fields[5]))
+        except ValueError:
+            continue
+
+
+def convert(events, mhz):
+    events = sorted(events, key=lambda e: e[1])
+    if not events:
+        return []
+    base = events[0][1]
+    out = []
+    running = {}        # cpu -> pid with an open "run" slice
+    seen = set()
+
+    def name_thread(cpu, tid, name):
+        if (cpu, tid) not in seen:
+            seen.add((cpu, tid))
+            out.append({"ph": "M", "name": "thread_name", "pid": cpu,
+                        "tid": tid, "args": {"name": name}})
+
+    for cpu, tsc, kind, pid, arg in events:
+        ts = (tsc - base) / mhz
+        if cpu not in running:
+            out.append({"ph": "M", "name": "process_name", "pid": cpu,
+                        "tid": 0, "args": {"name": "cpu %d" % cpu}})
+            running[cpu] = None
+        name_thread(cpu, pid, "idle" if pid == IDLE_PID else "pid %d" % pid)
+
+        if kind == "switch":
+            prev = running[cpu]
+            if prev is not None:
+                out.append({"ph": "E", "name": "run", "pid": cpu,
+                            "tid": prev, "ts": ts})
+            name_thread(cpu, arg,
+                        "idle" if arg == IDLE_PID else "pid %d" % arg)
+            out.append({"ph": "B", "name": "run", "pid": cpu, "tid": arg,
+                        "ts": ts})
+            running[cpu] = arg
+        elif kind in ("irq_enter", "irq_exit"):
+            tid = IRQ_TID_BASE + arg
+            label = IRQ_NAMES.get(arg, "irq %d" % arg)
+            name_thread(cpu, tid, "irq " + label)
+            out.append({"ph": "B" if kind == "irq_enter" else "E",
+                        "name": label, "pid": cpu, "tid": tid, "ts": ts})
+        else:
+            out.append({"ph": "i", "s": "t", "name": kind, "pid": cpu,
+                        "tid": pid, "ts": ts, "args": {"arg": arg}})
+
+    # close the slices still open at the end of the capture
+    end = (events[-1][1] - base) / mhz
+    for cpu, pid in running.items():
+        if pid is not None:
+            out.append({"ph": "E", "name": "run", "pid": cpu, "tid": pid,
+                        "ts": end})
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", nargs="?", help="captured output, default stdin")
+    parser.add_argument("--mhz", type=float, default=1000.0,
+                        help="TSC frequency in MHz (default 1000)")
+    args = parser.parse_args()
+
+    src = open(args.input) if args.input else sys.stdin
+    with src:
+        trace = convert(parse(src), args.mhz)
+    json.dump({"traceEvents": trace, "displayTimeUnit": "ns"}, sys.stdout)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()